@@ -0,0 +1,683 @@
+/**
+ * @file bench_harness.c
+ * @brief Multithreaded allocation workloads shared by the benchmark programs.
+ *
+ * Workloads:
+ *  - fixed:    malloc/free pairs of one 64-byte block.
+ *  - variable: fill a window of 1..1024-byte blocks, then free it.
+ *  - realloc:  fill a window of 128-byte blocks, resize each to 1..1024 bytes, free.
+ *  - larson:   replace random blocks in a window; windows move to the next
+ *              thread every round, so most frees hit blocks from another thread.
+ *  - prodcons: producer threads allocate and push blocks through a ring,
+ *              their paired consumer threads free them.
+ *  - xmalloc:  threads allocate batches, queue them, and free whichever
+ *              batch they dequeue, usually one allocated elsewhere.
+ *  - zipf:     replace random blocks in a window, with sizes up to 4 KiB
+ *              drawn from a Zipf distribution so that small sizes dominate.
+ *
+ * Harness memory (windows, rings, latency samples) is set up before the
+ * threads are released and is not timed.
+ *
+ * Author: Ameed Othman
+ * Date: 14/10/2026
+ */
+
+#include "bench_harness.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_THREADS "1,2,4,8,16,32"
+#define DEFAULT_OPS 100000        // Allocations per thread in each iteration
+#define DEFAULT_ITERATIONS 5      // Repetitions of each workload and thread count
+#define MAX_THREADS 256           // Largest accepted thread count
+#define SAMPLE_EVERY 16           // One allocator call in SAMPLE_EVERY is timed
+#define WINDOW 1024               // Live blocks per thread in the window workloads
+#define MAX_VAR_SIZE 1024         // Largest block in the variable and realloc workloads
+#define LARSON_MIN 16             // Smallest block in the larson workload
+#define LARSON_MAX 1024           // Largest block in the larson workload
+#define LARSON_ROUNDS 10          // Window hand-offs per larson iteration
+#define RING_SIZE 1024            // Blocks in flight between a producer and its consumer
+#define XMALLOC_BATCH 64          // Blocks per xmalloc batch
+#define XMALLOC_MAX 256           // Largest block in the xmalloc workload
+#define ZIPF_CLASSES 256          // Zipf sizes are 16, 32, ... ZIPF_CLASSES * 16 bytes
+
+/**
+ * @brief Per-thread state of a run.
+ */
+typedef struct bench_thread {
+    pthread_t thread;
+    int id;
+    uint64_t seed;          // xorshift state
+    uint64_t calls;         // Allocator calls made so far
+    uint32_t* samples;      // Sampled call latencies in nanoseconds
+    size_t nsamples;
+    size_t capacity;
+    uint64_t start_ns;      // When the thread passed the start barrier
+    uint64_t end_ns;        // When the thread finished its workload
+    int failed;             // Set when an allocation returned NULL
+} bench_thread_t;
+
+/**
+ * @brief Blocks travelling through the xmalloc queue.
+ */
+typedef struct xmalloc_batch {
+    size_t count;
+    void* blocks[XMALLOC_BATCH];
+} xmalloc_batch_t;
+
+/**
+ * @brief Single-producer, single-consumer ring for the prodcons workload.
+ */
+typedef struct bench_ring {
+    size_t head;            // Next slot the consumer reads, owned by the consumer
+    char pad[64 - sizeof(size_t)];
+    size_t tail;            // Next slot the producer writes, owned by the producer
+    void* slots[RING_SIZE];
+} bench_ring_t;
+
+typedef struct workload {
+    const char* name;
+    void (*run)(bench_thread_t* t);
+} workload_t;
+
+/** @brief State shared by the threads of the current run. */
+static struct {
+    const bench_allocator_t* alloc;
+    int nthreads;
+    size_t ops;
+    pthread_barrier_t start;        // Releases the threads together
+    pthread_barrier_t round;        // Separates larson rounds
+    void*** windows;                // larson windows, one per thread
+    bench_ring_t* rings;            // prodcons rings, one per thread pair
+    pthread_mutex_t queue_lock;     // Protects the xmalloc queue
+    xmalloc_batch_t** queue;        // xmalloc FIFO of 2 * nthreads entries
+    size_t queue_head;
+    size_t queue_count;
+    xmalloc_batch_t* batches;       // Backing store for the xmalloc batches
+} run;
+
+static double zipf_cdf[ZIPF_CLASSES];
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t next_random(bench_thread_t* t) {
+    uint64_t x = t->seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    t->seed = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t random_size(bench_thread_t* t, size_t min, size_t max) {
+    return min + (size_t)(next_random(t) % (max - min + 1));
+}
+
+/**
+ * @brief Draws a Zipf-distributed size from zipf_cdf.
+ */
+static size_t zipf_size(bench_thread_t* t) {
+    double u = (double)(next_random(t) >> 11) / (double)(1ULL << 53);
+    size_t low = 0;
+    size_t high = ZIPF_CLASSES - 1;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (zipf_cdf[mid] < u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return (low + 1) * 16;
+}
+
+static void record_sample(bench_thread_t* t, uint64_t start) {
+    if (t->nsamples < t->capacity) {
+        uint64_t elapsed = now_ns() - start;
+        t->samples[t->nsamples++] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    }
+}
+
+/**
+ * @brief Calls the allocator's malloc, timing one call in SAMPLE_EVERY.
+ *
+ * The first byte is written so that the block is really backed by memory.
+ */
+static void* bench_malloc(bench_thread_t* t, size_t size) {
+    void* ptr;
+    if (++t->calls % SAMPLE_EVERY == 0) {
+        uint64_t start = now_ns();
+        ptr = run.alloc->malloc_fn(size);
+        record_sample(t, start);
+    } else {
+        ptr = run.alloc->malloc_fn(size);
+    }
+    if (ptr) {
+        *(volatile char*)ptr = 1;
+    } else {
+        t->failed = 1;
+    }
+    return ptr;
+}
+
+static void* bench_realloc(bench_thread_t* t, void* ptr, size_t size) {
+    void* new_ptr;
+    if (++t->calls % SAMPLE_EVERY == 0) {
+        uint64_t start = now_ns();
+        new_ptr = run.alloc->realloc_fn(ptr, size);
+        record_sample(t, start);
+    } else {
+        new_ptr = run.alloc->realloc_fn(ptr, size);
+    }
+    if (!new_ptr) {
+        t->failed = 1;
+        return ptr;
+    }
+    return new_ptr;
+}
+
+static void bench_free(bench_thread_t* t, void* ptr) {
+    if (++t->calls % SAMPLE_EVERY == 0) {
+        uint64_t start = now_ns();
+        run.alloc->free_fn(ptr);
+        record_sample(t, start);
+    } else {
+        run.alloc->free_fn(ptr);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Workloads
+ * ------------------------------------------------------------------------- */
+
+static void workload_fixed(bench_thread_t* t) {
+    for (size_t i = 0; i < run.ops && !t->failed; i++) {
+        bench_free(t, bench_malloc(t, 64));
+    }
+}
+
+static void workload_variable(bench_thread_t* t) {
+    void* window[WINDOW];
+    for (size_t done = 0; done < run.ops && !t->failed; done += WINDOW) {
+        size_t count = run.ops - done < WINDOW ? run.ops - done : WINDOW;
+        for (size_t i = 0; i < count; i++) {
+            window[i] = bench_malloc(t, random_size(t, 1, MAX_VAR_SIZE));
+        }
+        for (size_t i = 0; i < count; i++) {
+            bench_free(t, window[i]);
+        }
+    }
+}
+
+static void workload_realloc(bench_thread_t* t) {
+    void* window[WINDOW];
+    for (size_t done = 0; done < run.ops && !t->failed; done += WINDOW) {
+        size_t count = run.ops - done < WINDOW ? run.ops - done : WINDOW;
+        for (size_t i = 0; i < count; i++) {
+            window[i] = bench_malloc(t, 128);
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (window[i]) {
+                window[i] = bench_realloc(t, window[i], random_size(t, 1, MAX_VAR_SIZE));
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            bench_free(t, window[i]);
+        }
+    }
+}
+
+/**
+ * @brief Larson server simulation.
+ *
+ * In round r thread i works on window (i + r) % nthreads, so each window is
+ * handed to another thread between rounds and its blocks are freed there.
+ */
+static void workload_larson(bench_thread_t* t) {
+    size_t per_round = run.ops / LARSON_ROUNDS + 1;
+    for (int round = 0; round < LARSON_ROUNDS; round++) {
+        void** window = run.windows[(t->id + round) % run.nthreads];
+        for (size_t i = 0; i < per_round; i++) {
+            size_t slot = (size_t)(next_random(t) % WINDOW);
+            bench_free(t, window[slot]);
+            window[slot] = bench_malloc(t, random_size(t, LARSON_MIN, LARSON_MAX));
+        }
+        pthread_barrier_wait(&run.round);
+    }
+    void** window = run.windows[(t->id + LARSON_ROUNDS) % run.nthreads];
+    for (size_t i = 0; i < WINDOW; i++) {
+        bench_free(t, window[i]);
+        window[i] = NULL;
+    }
+}
+
+/**
+ * @brief Producer-consumer with every free made by another thread.
+ *
+ * Even threads produce into ring id / 2 and the following odd thread
+ * consumes it. With an odd thread count the last thread frees its own blocks.
+ */
+static void workload_prodcons(bench_thread_t* t) {
+    if (t->id == run.nthreads - 1 && t->id % 2 == 0) {
+        workload_fixed(t);
+        return;
+    }
+    bench_ring_t* ring = &run.rings[t->id / 2];
+    if (t->id % 2 == 0) {
+        for (size_t i = 0; i < run.ops; i++) {
+            void* ptr = bench_malloc(t, random_size(t, LARSON_MIN, XMALLOC_MAX));
+            while (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SIZE) {
+                sched_yield();
+            }
+            ring->slots[ring->tail % RING_SIZE] = ptr;
+            __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+        }
+    } else {
+        for (size_t i = 0; i < run.ops; i++) {
+            while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head) {
+                sched_yield();
+            }
+            void* ptr = ring->slots[ring->head % RING_SIZE];
+            __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+            bench_free(t, ptr);
+        }
+    }
+}
+
+/**
+ * @brief xmalloc-test: allocate a batch, queue it, free the oldest queued batch.
+ *
+ * The queue starts with one empty batch per thread, so a thread normally
+ * dequeues a batch another thread filled.
+ */
+static void workload_xmalloc(bench_thread_t* t) {
+    size_t queue_size = 2 * (size_t)run.nthreads;
+    xmalloc_batch_t* batch = &run.batches[run.nthreads + t->id];
+    for (size_t done = 0; done < run.ops && !t->failed; done += XMALLOC_BATCH) {
+        for (batch->count = 0; batch->count < XMALLOC_BATCH; batch->count++) {
+            batch->blocks[batch->count] = bench_malloc(t, random_size(t, 8, XMALLOC_MAX));
+        }
+        pthread_mutex_lock(&run.queue_lock);
+        run.queue[(run.queue_head + run.queue_count) % queue_size] = batch;
+        batch = run.queue[run.queue_head];
+        run.queue_head = (run.queue_head + 1) % queue_size;
+        pthread_mutex_unlock(&run.queue_lock);
+        for (size_t i = 0; i < batch->count; i++) {
+            bench_free(t, batch->blocks[i]);
+        }
+        batch->count = 0;
+    }
+}
+
+static void workload_zipf(bench_thread_t* t) {
+    void* window[WINDOW] = {0};
+    for (size_t i = 0; i < run.ops && !t->failed; i++) {
+        size_t slot = (size_t)(next_random(t) % WINDOW);
+        bench_free(t, window[slot]);
+        window[slot] = bench_malloc(t, zipf_size(t));
+    }
+    for (size_t i = 0; i < WINDOW; i++) {
+        bench_free(t, window[i]);
+    }
+}
+
+static const workload_t workloads[] = {
+    {"fixed", workload_fixed},
+    {"variable", workload_variable},
+    {"realloc", workload_realloc},
+    {"larson", workload_larson},
+    {"prodcons", workload_prodcons},
+    {"xmalloc", workload_xmalloc},
+    {"zipf", workload_zipf},
+};
+
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+/* -------------------------------------------------------------------------
+ * Running and reporting
+ * ------------------------------------------------------------------------- */
+
+typedef struct bench_result {
+    uint64_t ops;
+    double seconds;
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t p999;
+    long peak_rss_kb;
+} bench_result_t;
+
+typedef struct worker_arg {
+    bench_thread_t* t;
+    const workload_t* workload;
+} worker_arg_t;
+
+static void* bench_worker(void* arg) {
+    worker_arg_t* worker = arg;
+    pthread_barrier_wait(&run.start);
+    worker->t->start_ns = now_ns();
+    worker->workload->run(worker->t);
+    worker->t->end_ns = now_ns();
+    return NULL;
+}
+
+/**
+ * @brief Resets the resident set high-water mark, if the kernel allows it.
+ */
+static void reset_peak_rss(void) {
+    FILE* fp = fopen("/proc/self/clear_refs", "w");
+    if (fp) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+/**
+ * @brief Returns the resident set high-water mark in KiB.
+ *
+ * Prefers VmHWM, which reset_peak_rss() can clear between iterations, and
+ * falls back to the process-lifetime peak from getrusage().
+ */
+static long read_peak_rss(void) {
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (fp) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "VmHWM: %ld", &kb) == 1) {
+                break;
+            }
+        }
+        fclose(fp);
+        if (kb >= 0) {
+            return kb;
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static int compare_samples(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t* sorted, size_t count, double fraction) {
+    if (count == 0) {
+        return 0;
+    }
+    return sorted[(size_t)(fraction * (double)(count - 1))];
+}
+
+/**
+ * @brief Sets up the shared state, runs one iteration and releases the state.
+ *
+ * @return int 0 on success, -1 if harness memory ran out or an allocation failed.
+ */
+static int bench_iteration(const workload_t* workload, int nthreads, bench_result_t* result) {
+    int status = -1;
+    size_t capacity = (2 * run.ops + 2 * WINDOW + XMALLOC_BATCH) / SAMPLE_EVERY + 1;
+    bench_thread_t* threads = calloc((size_t)nthreads, sizeof(bench_thread_t));
+    worker_arg_t* args = calloc((size_t)nthreads, sizeof(worker_arg_t));
+    uint32_t* samples = malloc((size_t)nthreads * capacity * sizeof(uint32_t));
+    run.nthreads = nthreads;
+    run.windows = calloc((size_t)nthreads, sizeof(void**));
+    run.rings = calloc((size_t)nthreads / 2 + 1, sizeof(bench_ring_t));
+    run.queue = calloc(2 * (size_t)nthreads, sizeof(xmalloc_batch_t*));
+    run.batches = calloc(2 * (size_t)nthreads, sizeof(xmalloc_batch_t));
+    if (!threads || !args || !samples || !run.windows || !run.rings || !run.queue || !run.batches) {
+        fprintf(stderr, "Error: out of memory setting up the benchmark.\n");
+        goto out;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        run.queue[i] = &run.batches[i];
+    }
+    run.queue_head = 0;
+    run.queue_count = (size_t)nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].id = i;
+        threads[i].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+        threads[i].samples = samples + (size_t)i * capacity;
+        threads[i].capacity = capacity;
+        args[i].t = &threads[i];
+        args[i].workload = workload;
+    }
+
+    // Prefill the larson windows outside the timed region
+    if (workload->run == workload_larson) {
+        for (int i = 0; i < nthreads; i++) {
+            run.windows[i] = calloc(WINDOW, sizeof(void*));
+            if (!run.windows[i]) {
+                fprintf(stderr, "Error: out of memory setting up the benchmark.\n");
+                goto out;
+            }
+            for (size_t j = 0; j < WINDOW; j++) {
+                run.windows[i][j] = run.alloc->malloc_fn(random_size(&threads[i], LARSON_MIN, LARSON_MAX));
+            }
+        }
+    }
+
+    pthread_barrier_init(&run.start, NULL, (unsigned)nthreads + 1);
+    pthread_barrier_init(&run.round, NULL, (unsigned)nthreads);
+    reset_peak_rss();
+    int started = 0;
+    while (started < nthreads) {
+        if (pthread_create(&threads[started].thread, NULL, bench_worker, &args[started]) != 0) {
+            fprintf(stderr, "Error: could not create benchmark thread.\n");
+            exit(EXIT_FAILURE);
+        }
+        started++;
+    }
+    pthread_barrier_wait(&run.start);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    // The threads time themselves: the main thread may be scheduled late
+    uint64_t start = UINT64_MAX;
+    uint64_t end = 0;
+    for (int i = 0; i < nthreads; i++) {
+        start = threads[i].start_ns < start ? threads[i].start_ns : start;
+        end = threads[i].end_ns > end ? threads[i].end_ns : end;
+    }
+    result->seconds = (double)(end - start) / 1e9;
+    result->peak_rss_kb = read_peak_rss();
+    pthread_barrier_destroy(&run.start);
+    pthread_barrier_destroy(&run.round);
+
+    // Blocks still queued at the end of an xmalloc run are freed untimed
+    for (size_t i = 0; i < run.queue_count; i++) {
+        xmalloc_batch_t* batch = run.queue[(run.queue_head + i) % (2 * (size_t)nthreads)];
+        for (size_t j = 0; j < batch->count; j++) {
+            run.alloc->free_fn(batch->blocks[j]);
+        }
+    }
+
+    // Gather the samples into one contiguous sorted run
+    size_t total = 0;
+    result->ops = 0;
+    status = 0;
+    for (int i = 0; i < nthreads; i++) {
+        memmove(samples + total, threads[i].samples, threads[i].nsamples * sizeof(uint32_t));
+        total += threads[i].nsamples;
+        result->ops += threads[i].calls;
+        if (threads[i].failed) {
+            fprintf(stderr, "Error: allocation failed in the %s workload.\n", workload->name);
+            status = -1;
+        }
+    }
+    qsort(samples, total, sizeof(uint32_t), compare_samples);
+    result->p50 = percentile(samples, total, 0.50);
+    result->p99 = percentile(samples, total, 0.99);
+    result->p999 = percentile(samples, total, 0.999);
+
+out:
+    if (run.windows) {
+        for (int i = 0; i < nthreads; i++) {
+            free(run.windows[i]);
+        }
+    }
+    free(run.windows);
+    free(run.rings);
+    free(run.queue);
+    free(run.batches);
+    free(samples);
+    free(args);
+    free(threads);
+    return status;
+}
+
+/**
+ * @brief Parses a comma-separated list of thread counts.
+ *
+ * @return int Number of entries stored, or -1 if the list is invalid.
+ */
+static int parse_threads(const char* list, int* counts, int max) {
+    int n = 0;
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value < 1 || value > MAX_THREADS || n == max || (*end && *end != ',')) {
+            return -1;
+        }
+        counts[n++] = (int)value;
+        p = *end ? end + 1 : end;
+    }
+    return n;
+}
+
+static const workload_t* find_workload(const char* name, size_t len) {
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        if (strlen(workloads[i].name) == len && strncmp(workloads[i].name, name, len) == 0) {
+            return &workloads[i];
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-t threads] [-w workloads] [-n ops] [-i iterations] [-o csv] [-l label]\n",
+            program);
+    fprintf(stderr, "Workloads:");
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        fprintf(stderr, " %s", workloads[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int bench_run(int argc, char** argv, const bench_allocator_t* alloc, const char* default_csv) {
+    int thread_counts[MAX_THREADS];
+    const workload_t* selected[WORKLOAD_COUNT];
+    const char* threads_arg = DEFAULT_THREADS;
+    const char* workloads_arg = NULL;
+    const char* csv_file = default_csv;
+    const char* label = alloc->name;
+    long iterations = DEFAULT_ITERATIONS;
+    long long ops = DEFAULT_OPS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:n:i:o:l:h")) != -1) {
+        switch (opt) {
+        case 't': threads_arg = optarg; break;
+        case 'w': workloads_arg = optarg; break;
+        case 'n': ops = atoll(optarg); break;
+        case 'i': iterations = atol(optarg); break;
+        case 'o': csv_file = optarg; break;
+        case 'l': label = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    int nthread_counts = parse_threads(threads_arg, thread_counts, MAX_THREADS);
+    if (nthread_counts <= 0 || ops < 1 || iterations < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t nselected = 0;
+    if (workloads_arg) {
+        const char* p = workloads_arg;
+        while (*p) {
+            size_t len = strcspn(p, ",");
+            const workload_t* workload = find_workload(p, len);
+            if (!workload || nselected == WORKLOAD_COUNT) {
+                fprintf(stderr, "Error: unknown workload '%.*s'.\n", (int)len, p);
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            selected[nselected++] = workload;
+            p += p[len] ? len + 1 : len;
+        }
+    } else {
+        for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+            selected[nselected++] = &workloads[i];
+        }
+    }
+
+    // P(size class k) is proportional to 1 / k
+    double sum = 0;
+    for (int k = 0; k < ZIPF_CLASSES; k++) {
+        sum += 1.0 / (k + 1);
+        zipf_cdf[k] = sum;
+    }
+    for (int k = 0; k < ZIPF_CLASSES; k++) {
+        zipf_cdf[k] /= sum;
+    }
+
+    FILE* fp = fopen(csv_file, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not open %s for writing.\n", csv_file);
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "allocator,workload,threads,iteration,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb\n");
+
+    run.alloc = alloc;
+    run.ops = (size_t)ops;
+    pthread_mutex_init(&run.queue_lock, NULL);
+    printf("%s: %lld allocations per thread, %ld iteration(s)\n", label, ops, iterations);
+    printf("%-9s %7s %14s %8s %8s %9s %12s\n", "workload", "threads", "ops/sec", "p50 ns", "p99 ns",
+           "p99.9 ns", "peak RSS KiB");
+    int status = EXIT_SUCCESS;
+    for (size_t w = 0; w < nselected && status == EXIT_SUCCESS; w++) {
+        for (int c = 0; c < nthread_counts && status == EXIT_SUCCESS; c++) {
+            for (long i = 0; i < iterations; i++) {
+                bench_result_t result;
+                if (bench_iteration(selected[w], thread_counts[c], &result) != 0) {
+                    status = EXIT_FAILURE;
+                    break;
+                }
+                double rate = (double)result.ops / result.seconds;
+                fprintf(fp, "%s,%s,%d,%ld,%llu,%.6f,%.0f,%u,%u,%u,%ld\n", label, selected[w]->name,
+                        thread_counts[c], i + 1, (unsigned long long)result.ops, result.seconds, rate,
+                        result.p50, result.p99, result.p999, result.peak_rss_kb);
+                if (i == 0) {
+                    printf("%-9s %7d %14.0f %8u %8u %9u %12ld\n", selected[w]->name, thread_counts[c], rate,
+                           result.p50, result.p99, result.p999, result.peak_rss_kb);
+                }
+            }
+        }
+    }
+    pthread_mutex_destroy(&run.queue_lock);
+    fclose(fp);
+
+    if (status == EXIT_SUCCESS) {
+        printf("Benchmark completed. Results written to %s\n", csv_file);
+    }
+    return status;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file bench_harness.h
+ * @brief Multithreaded allocation workloads shared by the benchmark programs.
+ *
+ * Each benchmark program describes the allocator it measures with a
+ * bench_allocator_t and hands over to bench_run(), which parses the command
+ * line, runs the selected workloads at every requested thread count and writes
+ * one CSV row per iteration:
+ *
+ *     allocator,workload,threads,iteration,ops,seconds,ops_per_sec,
+ *     p50_ns,p99_ns,p999_ns,peak_rss_kb
+ *
+ * ops counts allocator calls (malloc, realloc and free) made by all threads.
+ * Latencies are taken from a sample of individual calls, and peak_rss_kb is
+ * the resident set high-water mark during the iteration.
+ *
+ * Author: Ameed Othman
+ * Date: 14/10/2026
+ */
+
+#ifndef __BENCH_HARNESS_H__
+#define __BENCH_HARNESS_H__
+
+#include <stddef.h>
+
+/**
+ * @brief Entry points of the allocator under test.
+ */
+typedef struct bench_allocator {
+    const char* name;                           // Label written to the CSV, overridden by -l
+    void* (*malloc_fn)(size_t size);
+    void* (*realloc_fn)(void* ptr, size_t size);
+    void (*free_fn)(void* ptr);
+} bench_allocator_t;
+
+/**
+ * @brief Runs the benchmark suite against an allocator.
+ *
+ * Options:
+ *  -t LIST   Comma-separated thread counts (default 1,2,4,8,16,32)
+ *  -w LIST   Comma-separated workloads (default all), see -h for the list
+ *  -n COUNT  Allocations per thread in each iteration (default 100000)
+ *  -i COUNT  Iterations per workload and thread count (default 5)
+ *  -o FILE   CSV output file (default default_csv)
+ *  -l NAME   Allocator label for the CSV, e.g. when jemalloc is preloaded
+ *
+ * @param argc Argument count from main().
+ * @param argv Argument vector from main().
+ * @param alloc The allocator to measure.
+ * @param default_csv CSV file written when -o is not given.
+ * @return int EXIT_SUCCESS, or EXIT_FAILURE on bad arguments or allocation failure.
+ */
+int bench_run(int argc, char** argv, const bench_allocator_t* alloc, const char* default_csv);
+
+#endif
@@ -0,0 +1,29 @@
+/**
+ * @file benchmark_standard_malloc.c
+ * @brief Baseline benchmarks for the system malloc.
+ *
+ * Runs the workloads of bench_harness.c against malloc(), realloc() and
+ * free(). Other allocators are measured by preloading them and relabelling
+ * the results:
+ *
+ *     LD_PRELOAD=libjemalloc.so.2 build/bin/benchmark_standard_malloc -l jemalloc \
+ *         -o benchmarks/results/jemalloc_results.csv
+ *
+ * Author: Ameed Othman
+ * Date: 14/10/2026
+ */
+
+#include "bench_harness.h"
+#include <stdlib.h>
+
+#define CSV_FILE "benchmarks/results/standard_malloc_results.csv"
+
+int main(int argc, char** argv) {
+    bench_allocator_t alloc = {
+        .name = "libc",
+        .malloc_fn = malloc,
+        .realloc_fn = realloc,
+        .free_fn = free,
+    };
+    return bench_run(argc, argv, &alloc, CSV_FILE);
+}
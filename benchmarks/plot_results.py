@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Plot the CSV files written by the benchmark programs.
+
+For every workload, draws throughput (median ops/sec over the iterations)
+and p99 call latency against the thread count, one line per allocator, and
+saves the charts next to the first CSV file.
+
+Usage:
+    benchmarks/plot_results.py [results.csv ...]
+
+Author: Ameed Othman
+Date: 14/10/2026
+"""
+
+import csv
+import os
+import statistics
+import sys
+from collections import defaultdict
+
+import matplotlib
+
+matplotlib.use("Agg")
+import matplotlib.pyplot as plt  # noqa: E402
+
+DEFAULT_FILES = [
+    "benchmarks/results/allocator_results.csv",
+    "benchmarks/results/standard_malloc_results.csv",
+]
+
+METRICS = [
+    ("ops_per_sec", "ops/sec", "throughput.png"),
+    ("p99_ns", "p99 latency (ns)", "latency_p99.png"),
+    ("peak_rss_kb", "peak RSS (KiB)", "peak_rss.png"),
+]
+
+
+def load(paths):
+    """Return {(workload, allocator, threads): [rows]} from all CSV files."""
+    rows = defaultdict(list)
+    for path in paths:
+        if not os.path.exists(path) or os.path.getsize(path) == 0:
+            print(f"Skipping missing or empty {path}", file=sys.stderr)
+            continue
+        with open(path, newline="") as fp:
+            for row in csv.DictReader(fp):
+                key = (row["workload"], row["allocator"], int(row["threads"]))
+                rows[key].append(row)
+    return rows
+
+
+def plot(rows, column, label, output):
+    workloads = sorted({workload for workload, _, _ in rows})
+    allocators = sorted({allocator for _, allocator, _ in rows})
+    columns = min(len(workloads), 3)
+    lines = (len(workloads) + columns - 1) // columns
+    fig, axes = plt.subplots(lines, columns, figsize=(5 * columns, 3.5 * lines), squeeze=False)
+    for ax, workload in zip(axes.flat, workloads):
+        for allocator in allocators:
+            threads = sorted(t for w, a, t in rows if w == workload and a == allocator)
+            values = [statistics.median(float(r[column]) for r in rows[(workload, allocator, t)])
+                      for t in threads]
+            if threads:
+                ax.plot(threads, values, marker="o", label=allocator)
+        ax.set_title(workload)
+        ax.set_xlabel("threads")
+        ax.set_ylabel(label)
+        ax.set_xscale("log", base=2)
+        ax.grid(True, alpha=0.3)
+        ax.legend()
+    for ax in list(axes.flat)[len(workloads):]:
+        ax.set_visible(False)
+    fig.tight_layout()
+    fig.savefig(output)
+    plt.close(fig)
+    print(f"Wrote {output}")
+
+
+def main():
+    paths = sys.argv[1:] or DEFAULT_FILES
+    rows = load(paths)
+    if not rows:
+        print("No benchmark results to plot.", file=sys.stderr)
+        return 1
+    out_dir = os.path.dirname(paths[0]) or "."
+    for column, label, name in METRICS:
+        plot(rows, column, label, os.path.join(out_dir, name))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
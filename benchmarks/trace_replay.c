@@ -0,0 +1,528 @@
+/**
+ * @file trace_replay.c
+ * @brief Replays a recorded allocation trace against this allocator or the system malloc.
+ *
+ * Record a program through the preload shim, then replay the file against
+ * each allocator to compare them on the program's own traffic:
+ *
+ *     MTALLOC_RECORD=/tmp/app LD_PRELOAD=build/lib/libmtalloc.so ./app
+ *     build/bin/trace_replay -a mtalloc /tmp/app.1234
+ *     build/bin/trace_replay -a libc /tmp/app.1234
+ *     LD_PRELOAD=libjemalloc.so build/bin/trace_replay -a libc -l jemalloc /tmp/app.1234
+ *
+ * Calls are sorted by time and each recorded thread is replayed by one
+ * replay thread, several recorded threads sharing one when -t is lower. A
+ * free or realloc waits until the block it takes has been allocated by
+ * whichever thread allocated it in the recording, so blocks still cross
+ * threads the way they did. A trace that returns a block that is still live
+ * is rejected. Frees of blocks allocated before recording
+ * started are skipped, and blocks live when it stopped are released after
+ * the clock stops. Every allocation has its first byte written.
+ *
+ * The result is printed and, with -o, written as a CSV row:
+ *
+ *     allocator,trace,threads,calls,seconds,calls_per_sec,peak_rss_kb
+ *
+ * peak_rss_kb is the process peak and includes the decoded trace, which is
+ * the same for every allocator.
+ *
+ * Author: Ameed Othman
+ * Date: 14/10/2026
+ */
+
+#include "allocator.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256            // Largest accepted replay thread count
+#define NO_SLOT UINT32_MAX         // replay_op_t slot that is not used
+#define MAP_EMPTY 0                // Address map key of a never used entry
+#define MAP_DELETED 1              // Address map key of a removed entry
+
+/**
+ * @brief Entry points of the allocator under test.
+ */
+typedef struct replay_allocator {
+    const char* name;
+    void* (*malloc_fn)(size_t size);
+    void* (*calloc_fn)(size_t nmemb, size_t size);
+    void* (*realloc_fn)(void* ptr, size_t size);
+    void* (*aligned_fn)(size_t alignment, size_t size);
+    void (*free_fn)(void* ptr);
+} replay_allocator_t;
+
+static const replay_allocator_t allocators[] = {
+    {"mtalloc", allocator_malloc, allocator_calloc, allocator_realloc, allocator_aligned_alloc, allocator_free},
+    {"libc", malloc, calloc, realloc, aligned_alloc, free},
+};
+
+/**
+ * @brief One call to replay, with blocks named by slot instead of address.
+ */
+typedef struct replay_op {
+    uint64_t size;
+    uint32_t in;               // Slot of the block freed or resized, or NO_SLOT
+    uint32_t out;              // Slot the returned block goes in, or NO_SLOT
+    uint32_t thread;           // Replay thread
+    uint16_t op;               // ALLOCATOR_RECORD_*
+    uint16_t align_shift;
+} replay_op_t;
+
+/**
+ * @brief Per-thread state of the replay.
+ */
+typedef struct replay_thread {
+    pthread_t thread;
+    replay_op_t* ops;
+    size_t nops;
+    uint64_t start_ns;         // When the thread passed the start barrier
+    uint64_t end_ns;           // When it finished its last call
+} replay_thread_t;
+
+/**
+ * @brief Address to slot map of the blocks live at a point of the trace.
+ */
+typedef struct slot_map {
+    uint64_t* keys;
+    uint32_t* values;
+    size_t mask;
+} slot_map_t;
+
+static const replay_allocator_t* replay_alloc;
+static void** slots;               // Block of each slot, NULL until it is allocated and once it is taken
+static pthread_barrier_t start_barrier;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static size_t map_find(const slot_map_t* map, uint64_t key, int for_insert) {
+    size_t index = (size_t)((key >> 4) * 0x9E3779B97F4A7C15ULL) & map->mask;
+    size_t reuse = SIZE_MAX;
+    while (map->keys[index] != MAP_EMPTY) {
+        if (map->keys[index] == key) {
+            return index;
+        }
+        if (map->keys[index] == MAP_DELETED && reuse == SIZE_MAX) {
+            reuse = index;
+        }
+        index = (index + 1) & map->mask;
+    }
+    return for_insert && reuse != SIZE_MAX ? reuse : index;
+}
+
+/**
+ * @brief Adds a block to the map.
+ *
+ * @return int Returns 0, or -1 if the address is already live.
+ */
+static int map_put(slot_map_t* map, uint64_t key, uint32_t value) {
+    size_t index = map_find(map, key, 1);
+    if (map->keys[index] == key) {
+        return -1;
+    }
+    map->keys[index] = key;
+    map->values[index] = value;
+    return 0;
+}
+
+/**
+ * @brief Removes an address from the map.
+ *
+ * @return uint32_t The slot it was in, or NO_SLOT if it was not live.
+ */
+static uint32_t map_take(slot_map_t* map, uint64_t key) {
+    size_t index = map_find(map, key, 0);
+    if (map->keys[index] != key) {
+        return NO_SLOT;
+    }
+    map->keys[index] = MAP_DELETED;
+    return map->values[index];
+}
+
+// A realloc is sorted twice: entry 2 * i releases the old block of record i
+// at release_ns and entry 2 * i + 1 returns the new one at time_ns. Other
+// records only use entry 2 * i
+#define ENTRY_RECORD(entry) ((entry) >> 1)
+#define ENTRY_RETURNS(entry) ((entry) & 1)
+
+static const allocator_record_t* sort_records;
+
+static uint64_t entry_time(size_t entry) {
+    const allocator_record_t* record = &sort_records[ENTRY_RECORD(entry)];
+    return record->op == ALLOCATOR_RECORD_REALLOC && !ENTRY_RETURNS(entry) ? record->release_ns : record->time_ns;
+}
+
+static int entry_releases(size_t entry) {
+    unsigned int op = sort_records[ENTRY_RECORD(entry)].op;
+    return !ENTRY_RETURNS(entry) && (op == ALLOCATOR_RECORD_FREE || op == ALLOCATOR_RECORD_REALLOC);
+}
+
+static int compare_entries(const void* a, const void* b) {
+    size_t i = *(const size_t*)a;
+    size_t j = *(const size_t*)b;
+    uint64_t x = entry_time(i);
+    uint64_t y = entry_time(j);
+    if (x != y) {
+        return x < y ? -1 : 1;
+    }
+    // A block released in the same nanosecond as it was reused came first
+    if (entry_releases(i) != entry_releases(j)) {
+        return entry_releases(i) ? -1 : 1;
+    }
+    // Entries of one thread keep their file order
+    return i < j ? -1 : i > j;
+}
+
+/**
+ * @brief Reads a record file.
+ *
+ * @param path The file.
+ * @param count Set to the number of entries.
+ * @return allocator_record_t* The entries, or NULL with a message printed.
+ */
+static allocator_record_t* load_records(const char* path, size_t* count) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not open %s.\n", path);
+        return NULL;
+    }
+    allocator_record_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, ALLOCATOR_RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != ALLOCATOR_RECORD_VERSION || header.record_size != sizeof(allocator_record_t)) {
+        fprintf(stderr, "Error: %s is not a version %d allocation record.\n", path, ALLOCATOR_RECORD_VERSION);
+        fclose(fp);
+        return NULL;
+    }
+    size_t capacity = 1 << 16;
+    size_t used = 0;
+    allocator_record_t* records = malloc(capacity * sizeof(allocator_record_t));
+    while (records) {
+        used += fread(records + used, sizeof(allocator_record_t), capacity - used, fp);
+        if (used < capacity) {
+            break;
+        }
+        capacity *= 2;
+        allocator_record_t* grown = realloc(records, capacity * sizeof(allocator_record_t));
+        if (!grown) {
+            free(records);
+        }
+        records = grown;
+    }
+    fclose(fp);
+    if (!records) {
+        fprintf(stderr, "Error: Out of memory reading %s.\n", path);
+        return NULL;
+    }
+    *count = used;
+    return records;
+}
+
+/**
+ * @brief Turns the entries into replay_op_t in time order, naming blocks by slot.
+ *
+ * @param records The entries.
+ * @param count Number of entries.
+ * @param nthreads Replay threads; recorded thread i goes to replay thread i % nthreads.
+ * @param nops Set to the number of calls kept.
+ * @param nslots Set to the number of slots used.
+ * @return replay_op_t* The calls, or NULL with a message printed when out of
+ *         memory or when the trace returns a live block again.
+ */
+static replay_op_t* build_ops(const allocator_record_t* records, size_t count, int nthreads, size_t* nops,
+                              uint32_t* nslots) {
+    size_t nentries = 0;
+    for (size_t i = 0; i < count; i++) {
+        nentries += records[i].op == ALLOCATOR_RECORD_REALLOC ? 2 : 1;
+    }
+    size_t* order = malloc((nentries ? nentries : 1) * sizeof(size_t));
+    size_t* op_of = malloc((count ? count : 1) * sizeof(size_t));
+    replay_op_t* ops = malloc((count ? count : 1) * sizeof(replay_op_t));
+    slot_map_t map;
+    size_t map_size = 16;
+    while (map_size < 2 * count) {
+        map_size *= 2;
+    }
+    map.keys = calloc(map_size, sizeof(uint64_t));
+    map.values = malloc(map_size * sizeof(uint32_t));
+    map.mask = map_size - 1;
+    if (!order || !op_of || !ops || !map.keys || !map.values) {
+        fprintf(stderr, "Error: Out of memory decoding the trace.\n");
+        free(order);
+        free(op_of);
+        free(ops);
+        free(map.keys);
+        free(map.values);
+        return NULL;
+    }
+    nentries = 0;
+    for (size_t i = 0; i < count; i++) {
+        op_of[i] = SIZE_MAX;
+        order[nentries++] = 2 * i;
+        if (records[i].op == ALLOCATOR_RECORD_REALLOC) {
+            order[nentries++] = 2 * i + 1;
+        }
+    }
+    sort_records = records;
+    qsort(order, nentries, sizeof(size_t), compare_entries);
+
+    // Calls are kept in the order they were made; a realloc's new block gets
+    // its slot when it returns, after blocks other threads freed meanwhile
+    size_t kept = 0;
+    uint32_t next_slot = 0;
+    int failed = 0;
+    for (size_t i = 0; i < nentries && !failed; i++) {
+        size_t index = ENTRY_RECORD(order[i]);
+        const allocator_record_t* record = &records[index];
+        if (!ENTRY_RETURNS(order[i])) {
+            replay_op_t op = {.size = record->size, .in = NO_SLOT, .out = NO_SLOT,
+                              .thread = record->thread % (uint32_t)nthreads, .op = record->op,
+                              .align_shift = record->align_shift};
+            switch (record->op) {
+            case ALLOCATOR_RECORD_FREE:
+                op.in = map_take(&map, record->ptr);
+                if (op.in == NO_SLOT) {
+                    continue; // Allocated before recording started
+                }
+                break;
+            case ALLOCATOR_RECORD_REALLOC:
+                op.in = map_take(&map, record->old_ptr);
+                if (op.in == NO_SLOT) {
+                    op.op = ALLOCATOR_RECORD_MALLOC;
+                }
+                break;
+            case ALLOCATOR_RECORD_MALLOC:
+            case ALLOCATOR_RECORD_CALLOC:
+            case ALLOCATOR_RECORD_ALIGNED:
+                break;
+            default:
+                continue;
+            }
+            op_of[index] = kept;
+            ops[kept++] = op;
+            if (record->op == ALLOCATOR_RECORD_REALLOC) {
+                continue;
+            }
+        }
+        if (record->op == ALLOCATOR_RECORD_FREE || op_of[index] == SIZE_MAX || record->ptr <= MAP_DELETED) {
+            continue;
+        }
+        ops[op_of[index]].out = next_slot;
+        if (map_put(&map, record->ptr, next_slot++) != 0) {
+            fprintf(stderr, "Error: Block %#llx returned at %llu ns while still live; the trace is out of order.\n",
+                    (unsigned long long)record->ptr, (unsigned long long)record->time_ns);
+            failed = 1;
+        }
+    }
+    free(order);
+    free(op_of);
+    free(map.keys);
+    free(map.values);
+    if (failed) {
+        free(ops);
+        return NULL;
+    }
+    *nops = kept;
+    *nslots = next_slot;
+    return ops;
+}
+
+/**
+ * @brief Waits until a slot's block has been allocated and takes it.
+ */
+static void* take_slot(uint32_t slot) {
+    void* ptr;
+    while (!(ptr = __atomic_load_n(&slots[slot], __ATOMIC_ACQUIRE))) {
+        sched_yield();
+    }
+    __atomic_store_n(&slots[slot], NULL, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+static void* replay_worker(void* arg) {
+    replay_thread_t* t = (replay_thread_t*)arg;
+    pthread_barrier_wait(&start_barrier);
+    t->start_ns = now_ns();
+    for (size_t i = 0; i < t->nops; i++) {
+        const replay_op_t* op = &t->ops[i];
+        void* old = op->in != NO_SLOT ? take_slot(op->in) : NULL;
+        size_t size = op->size ? (size_t)op->size : 1;
+        void* ptr = NULL;
+        switch (op->op) {
+        case ALLOCATOR_RECORD_MALLOC: ptr = replay_alloc->malloc_fn(size); break;
+        case ALLOCATOR_RECORD_CALLOC: ptr = replay_alloc->calloc_fn(1, size); break;
+        case ALLOCATOR_RECORD_ALIGNED: ptr = replay_alloc->aligned_fn((size_t)1 << op->align_shift, size); break;
+        case ALLOCATOR_RECORD_REALLOC: ptr = replay_alloc->realloc_fn(old, size); break;
+        case ALLOCATOR_RECORD_FREE: replay_alloc->free_fn(old); break;
+        }
+        if (op->out != NO_SLOT) {
+            if (!ptr) {
+                // Other threads may be waiting for this block, so give up at once
+                fprintf(stderr, "Error: Allocation of %zu bytes failed during replay.\n", size);
+                exit(EXIT_FAILURE);
+            }
+            *(volatile char*)ptr = 1;
+            __atomic_store_n(&slots[op->out], ptr, __ATOMIC_RELEASE);
+        }
+    }
+    t->end_ns = now_ns();
+    return NULL;
+}
+
+static long read_peak_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-a mtalloc|libc] [-t THREADS] [-l LABEL] [-o CSV] FILE\n", program);
+    fprintf(stderr, "  -a  allocator to replay against (default mtalloc)\n");
+    fprintf(stderr, "  -t  replay threads (default one per recorded thread, at most %d)\n", MAX_THREADS);
+    fprintf(stderr, "  -l  allocator label for the output, e.g. when jemalloc is preloaded\n");
+    fprintf(stderr, "  -o  CSV file to write the result to\n");
+}
+
+int main(int argc, char** argv) {
+    const char* label = NULL;
+    const char* csv_file = NULL;
+    int nthreads = 0;
+    replay_alloc = &allocators[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:t:l:o:h")) != -1) {
+        switch (opt) {
+        case 'a':
+            replay_alloc = NULL;
+            for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+                if (strcmp(optarg, allocators[i].name) == 0) {
+                    replay_alloc = &allocators[i];
+                }
+            }
+            if (!replay_alloc) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't': nthreads = atoi(optarg); break;
+        case 'l': label = optarg; break;
+        case 'o': csv_file = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || nthreads < 0 || nthreads > MAX_THREADS) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* trace = argv[optind];
+    if (!label) {
+        label = replay_alloc->name;
+    }
+
+    size_t count = 0;
+    allocator_record_t* records = load_records(trace, &count);
+    if (!records) {
+        return EXIT_FAILURE;
+    }
+    if (nthreads == 0) {
+        uint32_t recorded = 0;
+        for (size_t i = 0; i < count; i++) {
+            recorded = records[i].thread + 1 > recorded ? records[i].thread + 1 : recorded;
+        }
+        nthreads = recorded == 0 ? 1 : recorded > MAX_THREADS ? MAX_THREADS : (int)recorded;
+    }
+    size_t nops = 0;
+    uint32_t nslots = 0;
+    replay_op_t* ops = build_ops(records, count, nthreads, &nops, &nslots);
+    free(records);
+    if (!ops) {
+        return EXIT_FAILURE;
+    }
+    slots = calloc(nslots ? nslots : 1, sizeof(void*));
+    replay_thread_t* threads = calloc((size_t)nthreads, sizeof(replay_thread_t));
+    replay_op_t* sorted = malloc((nops ? nops : 1) * sizeof(replay_op_t));
+    if (!slots || !threads || !sorted) {
+        fprintf(stderr, "Error: Out of memory decoding %s.\n", trace);
+        return EXIT_FAILURE;
+    }
+    // Give each replay thread its calls in time order, in one array
+    for (size_t i = 0; i < nops; i++) {
+        threads[ops[i].thread].nops++;
+    }
+    size_t offset = 0;
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].ops = sorted + offset;
+        offset += threads[i].nops;
+        threads[i].nops = 0;
+    }
+    for (size_t i = 0; i < nops; i++) {
+        replay_thread_t* t = &threads[ops[i].thread];
+        t->ops[t->nops++] = ops[i];
+    }
+    free(ops);
+
+    if (replay_alloc == &allocators[0] && allocator_init() != 0) {
+        fprintf(stderr, "Error: Failed to initialize allocator.\n");
+        return EXIT_FAILURE;
+    }
+    pthread_barrier_init(&start_barrier, NULL, (unsigned int)nthreads + 1);
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i].thread, NULL, replay_worker, &threads[i]) != 0) {
+            fprintf(stderr, "Error: Could not create replay thread.\n");
+            return EXIT_FAILURE;
+        }
+    }
+    pthread_barrier_wait(&start_barrier);
+    // The workers time themselves; this thread may run again only after they finish
+    uint64_t start = UINT64_MAX;
+    uint64_t end = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        start = threads[i].start_ns < start ? threads[i].start_ns : start;
+        end = threads[i].end_ns > end ? threads[i].end_ns : end;
+    }
+    double seconds = (double)(end - start) / 1e9;
+    long peak_rss_kb = read_peak_rss();
+
+    // Blocks the recording never freed
+    for (uint32_t i = 0; i < nslots; i++) {
+        if (slots[i]) {
+            replay_alloc->free_fn(slots[i]);
+        }
+    }
+    double rate = seconds > 0 ? (double)nops / seconds : 0;
+    printf("%s: %zu calls on %d threads in %.6f s, %.0f calls/sec, peak RSS %ld KiB\n", label, nops, nthreads,
+           seconds, rate, peak_rss_kb);
+    int status = EXIT_SUCCESS;
+    if (csv_file) {
+        FILE* fp = fopen(csv_file, "w");
+        if (fp) {
+            fprintf(fp, "allocator,trace,threads,calls,seconds,calls_per_sec,peak_rss_kb\n");
+            fprintf(fp, "%s,%s,%d,%zu,%.6f,%.0f,%ld\n", label, trace, nthreads, nops, seconds, rate, peak_rss_kb);
+            fclose(fp);
+        } else {
+            fprintf(stderr, "Error: Could not open %s for writing.\n", csv_file);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    pthread_barrier_destroy(&start_barrier);
+    free(sorted);
+    free(threads);
+    free(slots);
+    if (replay_alloc == &allocators[0]) {
+        allocator_destroy();
+    }
+    return status;
+}
@@ -14,16 +14,186 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
+
+/** @brief Number of small size classes reported by allocator_get_stats(), 16 bytes apart. */
+#define ALLOCATOR_STATS_CLASSES 64
+
+/** @brief Distance in bytes between small size classes; class i holds (i + 1) * ALLOCATOR_CLASS_SPACING bytes. */
+#define ALLOCATOR_CLASS_SPACING 16
+
+/** @brief Number of buckets in an allocator_latency_t histogram. */
+#define ALLOCATOR_LATENCY_BUCKETS 256
+
+/**
+ * @brief Histogram of durations in nanoseconds.
+ *
+ * Bucket i below 8 counts durations of exactly i ns. Above that, every power
+ * of two is split into 8 equal buckets, so a bucket is at most 12.5% wide,
+ * and the last bucket also counts everything slower.
+ */
+typedef struct allocator_latency {
+    uint64_t count;             // Durations recorded
+    uint64_t total_ns;          // Sum of the durations
+    uint64_t buckets[ALLOCATOR_LATENCY_BUCKETS];
+} allocator_latency_t;
+
+/**
+ * @brief Snapshot of allocator activity, filled in by allocator_get_stats().
+ *
+ * Counters are cumulative since the process started; byte totals describe
+ * the moment of the call. Small class i holds objects of (i + 1) * 16 bytes.
+ * Blocks released by allocator_destroy() without being freed stay in live_bytes.
+ */
+typedef struct allocator_stats {
+    size_t mapped_bytes;        // Bytes currently mapped from the OS
+    size_t live_bytes;          // Bytes currently allocated, in usable (rounded) sizes
+    size_t free_bytes;          // Bytes sitting in the heap's free bins
+    size_t purged_bytes;        // Bytes returned to the OS with madvise()
+    uint64_t mmap_calls;        // mmap() calls
+    uint64_t munmap_calls;      // munmap() calls
+    uint64_t mremap_calls;      // mremap() calls that resized a huge allocation
+    uint64_t lock_contentions;  // Arena lock acquisitions that had to wait
+    uint64_t cache_hits;        // Small allocations served straight from the thread cache
+    uint64_t cache_misses;      // Small allocations that had to refill the thread cache
+    uint64_t small_allocs[ALLOCATOR_STATS_CLASSES]; // Allocations per small size class
+    uint64_t small_frees[ALLOCATOR_STATS_CLASSES];  // Frees per small size class
+    uint64_t large_allocs;      // Heap allocations above the small classes
+    uint64_t large_frees;       // Heap frees above the small classes
+    uint64_t huge_allocs;       // Allocations given a dedicated mapping
+    uint64_t huge_frees;        // Frees of dedicated mappings
+    // Empty unless the allocator is built with ALLOCATOR_TRACE
+    allocator_latency_t lock_wait; // Time spent waiting for an arena lock
+    allocator_latency_t lock_hold; // Time an arena lock was held
+    allocator_latency_t os_map;    // Time spent mapping a chunk for a growing heap
+} allocator_stats_t;
+
+/** @brief allocator_heap_block_t kind: a heap block, free or in use. */
+#define ALLOCATOR_WALK_HEAP 0
+/** @brief allocator_heap_block_t kind: one slab of same-sized small objects. */
+#define ALLOCATOR_WALK_SLAB 1
+/** @brief allocator_heap_block_t kind: a dedicated mapping holding one allocation. */
+#define ALLOCATOR_WALK_HUGE 2
+
+/**
+ * @brief One block of the heap, passed to an allocator_heap_walk() callback.
+ *
+ * Blocks cached by a thread count as in use, since the heap has handed them out.
+ */
+typedef struct allocator_heap_block {
+    void* addr;                 // Payload address, or the first object of a slab
+    size_t size;                // Usable bytes, or the bytes a slab holds objects in
+    int kind;                   // ALLOCATOR_WALK_HEAP, ALLOCATOR_WALK_SLAB or ALLOCATOR_WALK_HUGE
+    int free;                   // Set for a free heap block or a slab with no size class
+    unsigned int arena;         // Arena that owns the block, 0 for huge mappings
+    void* mapping;              // Start of the mapping the block lies in
+    size_t mapping_size;        // Bytes of that mapping
+    size_t obj_size;            // Object size of a slab, 0 while it is free
+    size_t objects_used;        // Objects a slab has handed out
+} allocator_heap_block_t;
+
+/**
+ * @brief Callback of allocator_heap_walk().
+ *
+ * Runs with an allocator lock held, so it must not allocate or free through
+ * this allocator, which includes malloc() and stdio when the shim is used.
+ *
+ * @return int 0 to continue, anything else to stop the walk.
+ */
+typedef int (*allocator_heap_walk_fn)(const allocator_heap_block_t* block, void* ctx);
+
+/** @brief Number of free block size classes in allocator_heap_summary_t, one per power of two. */
+#define ALLOCATOR_FREE_CLASSES 32
+
+/**
+ * @brief How the heap is used and fragmented, filled in by allocator_heap_summary().
+ */
+typedef struct allocator_heap_summary {
+    size_t mappings;            // Heap and slab chunks and huge mappings
+    size_t mapped_bytes;        // Bytes of those mappings
+    size_t used_bytes;          // Bytes in use: heap blocks, slab objects and huge payloads
+    size_t free_bytes;          // Bytes in free heap blocks
+    size_t free_blocks;         // Number of free heap blocks
+    size_t largest_free;        // Size of the largest free heap block
+    double fragmentation;       // 1 - largest_free / free_bytes, 0 with no free block
+    uint64_t free_histogram[ALLOCATOR_FREE_CLASSES]; // Free blocks of 2^i up to 2^(i+1) - 1 bytes
+} allocator_heap_summary_t;
+
+/** @brief allocator_record_t op: malloc(), or realloc() of NULL. */
+#define ALLOCATOR_RECORD_MALLOC 1
+/** @brief allocator_record_t op: calloc(); size is the total in bytes. */
+#define ALLOCATOR_RECORD_CALLOC 2
+/** @brief allocator_record_t op: realloc() of a live block. */
+#define ALLOCATOR_RECORD_REALLOC 3
+/** @brief allocator_record_t op: free(). */
+#define ALLOCATOR_RECORD_FREE 4
+/** @brief allocator_record_t op: aligned_alloc(), posix_memalign() and the like. */
+#define ALLOCATOR_RECORD_ALIGNED 5
+
+/** @brief First bytes of a file written by allocator_record_start(). */
+#define ALLOCATOR_RECORD_MAGIC "MTRECORD"
+/** @brief Format version in allocator_record_header_t. */
+#define ALLOCATOR_RECORD_VERSION 1
+
+/**
+ * @brief Start of an allocation record file, followed by allocator_record_t entries.
+ */
+typedef struct allocator_record_header {
+    char magic[8];              // ALLOCATOR_RECORD_MAGIC, not NUL-terminated
+    uint32_t version;           // ALLOCATOR_RECORD_VERSION
+    uint32_t record_size;       // sizeof(allocator_record_t)
+} allocator_record_header_t;
+
+/**
+ * @brief One recorded call, in the byte order of the recording machine.
+ *
+ * Each thread's entries appear in the order it made the calls, but the
+ * threads' entries are interleaved in batches, so sort by time_ns to see
+ * the calls in process order. Frees are timed before the block is released
+ * and allocations after they return, so a block is always freed before its
+ * address comes back from another allocation. A realloc() is both: old_ptr
+ * is released at release_ns and ptr returned at time_ns.
+ */
+typedef struct allocator_record {
+    uint64_t time_ns;           // Nanoseconds since recording started
+    uint64_t release_ns;        // When a realloc() was called, before old_ptr was released; else time_ns
+    uint64_t ptr;               // Block returned, or the block freed for ALLOCATOR_RECORD_FREE
+    uint64_t old_ptr;           // Block passed to realloc(), 0 for other ops
+    uint64_t size;              // Requested bytes, 0 for ALLOCATOR_RECORD_FREE
+    uint32_t thread;            // Calling thread, numbered from 0 as threads first record
+    uint16_t op;                // ALLOCATOR_RECORD_*
+    uint16_t align_shift;       // log2 of the alignment of ALLOCATOR_RECORD_ALIGNED, else 0
+} allocator_record_t;
+
+/**
+ * @brief A region: objects allocated from it are all released at once.
+ */
+typedef struct allocator_arena allocator_arena_t;
+
+/**
+ * @brief A pool of fixed-size objects with its own slabs.
+ */
+typedef struct allocator_pool allocator_pool_t;
 
 /**
  * @brief Initializes the memory allocator.
  *
+ * The allocator also sets itself up on first use, so calling this is
+ * optional. Setup runs once: it reads the CPU count and page size, creates
+ * the arenas, gives the calling thread's arena its first slab chunk and
+ * registers allocator_prefork() and its partners with pthread_atfork().
+ * Starts the background thread when the background_thread setting is 1.
+ * Calling it again is harmless.
+ *
  * @return int Returns 0 on success, non-zero on failure.
  */
 int allocator_init(void);
 
 /**
  * @brief Shuts down the memory allocator and releases all resources.
+ *
+ * Stops the background thread first, if it runs. Pools that are still
+ * open are destroyed along with their objects.
  */
 void allocator_destroy(void);
 
@@ -51,15 +221,411 @@ void* allocator_realloc(void* ptr, size_t size);
  */
 void allocator_free(void* ptr);
 
+/**
+ * @brief Allocates a block of memory placed on a given NUMA node.
+ *
+ * The block comes from an arena bound to the node, bypassing the thread
+ * cache, and is released with allocator_free() as usual. On hosts without
+ * NUMA support only node 0 exists.
+ *
+ * @param size The size of the memory block in bytes.
+ * @param node NUMA node number, as listed in /sys/devices/system/node/online.
+ * @return void* Pointer to the allocated memory, or NULL on failure or if node is unknown.
+ */
+void* allocator_malloc_onnode(size_t size, int node);
+
+/**
+ * @brief Allocates an object of a small size class chosen by the caller.
+ *
+ * Class i holds objects of (i + 1) * 16 bytes, up to ALLOCATOR_STATS_CLASSES
+ * classes, as in allocator_stats_t. Callers that know the size at compile
+ * time, such as the C++ wrappers in allocator.hpp, thereby skip the size
+ * rounding and class lookup of allocator_malloc().
+ *
+ * @param size_class The size class.
+ * @return void* Pointer to the allocated memory, or NULL on failure or if size_class is out of range.
+ */
+void* allocator_malloc_class(unsigned int size_class);
+
+/**
+ * @brief Frees an object allocated with allocator_malloc_class().
+ *
+ * The same rules as for allocator_free_sized() apply: any block allocated
+ * with a size in the class may be freed this way, except blocks from
+ * allocator_aligned_alloc() or allocator_posix_memalign().
+ *
+ * @param ptr Pointer to the object, or NULL.
+ * @param size_class The class passed to allocator_malloc_class().
+ */
+void allocator_free_class(void* ptr, unsigned int size_class);
+
+/**
+ * @brief Frees a memory block whose size the caller already knows.
+ *
+ * Matches C++14 sized deallocation. For small blocks the size class is taken
+ * from size, so the allocator does not have to look it up. Blocks from
+ * allocator_aligned_alloc() or allocator_posix_memalign() must be released
+ * with allocator_free() instead.
+ *
+ * @param ptr Pointer to the memory block to be freed.
+ * @param size The size passed to the call that allocated or last resized the block.
+ */
+void allocator_free_sized(void* ptr, size_t size);
+
+/**
+ * @brief Allocates n blocks of the same size at once.
+ *
+ * Small blocks come from the thread cache and then straight from the slabs,
+ * and heap blocks are carved out under a single arena lock, rather than
+ * paying for one allocator_malloc() call per block.
+ *
+ * @param size The size of each memory block in bytes.
+ * @param n Number of blocks to allocate.
+ * @param out Array of at least n entries that receives the block pointers.
+ * @return size_t Number of blocks stored in out, less than n if memory ran out.
+ */
+size_t allocator_malloc_batch(size_t size, size_t n, void** out);
+
+/**
+ * @brief Frees n memory blocks at once.
+ *
+ * Consecutive heap blocks from the same arena are released under one lock,
+ * or handed to their owning arena in one push. Entries may be NULL.
+ *
+ * @param ptrs Array of pointers to the memory blocks to be freed.
+ * @param n Number of entries in ptrs.
+ */
+void allocator_free_batch(void** ptrs, size_t n);
+
 /**
  * @brief Allocates memory for an array of elements and initializes them to zero.
  *
+ * Memory that has not been written since it was mapped is not cleared again.
+ *
  * @param nmemb Number of elements.
  * @param size Size of each element in bytes.
- * @return void* Pointer to the allocated memory, or NULL on failure.
+ * @return void* Pointer to the allocated memory, or NULL on failure or if nmemb * size overflows.
  */
 void* allocator_calloc(size_t nmemb, size_t size);
 
+/**
+ * @brief Allocates a block of memory aligned to a power of two.
+ *
+ * Padding needed to reach the alignment is returned to the allocator rather
+ * than wasted. The block is released with allocator_free(); a later
+ * allocator_realloc() does not preserve the alignment.
+ *
+ * @param alignment Required alignment in bytes, a power of two below ALLOCATOR_CHUNK_SIZE.
+ * @param size The size of the memory block in bytes.
+ * @return void* Pointer to the allocated memory, or NULL on failure or if alignment is unsupported.
+ */
+void* allocator_aligned_alloc(size_t alignment, size_t size);
+
+/**
+ * @brief Allocates an aligned block of memory, POSIX style.
+ *
+ * @param memptr Where the pointer to the allocated memory is stored on success.
+ * @param alignment Required alignment in bytes, a power of two multiple of sizeof(void*).
+ * @param size The size of the memory block in bytes.
+ * @return int Returns 0 on success, EINVAL if alignment is invalid, ENOMEM if memory is exhausted
+ *         or alignment is unsupported.
+ */
+int allocator_posix_memalign(void** memptr, size_t alignment, size_t size);
+
+/**
+ * @brief Creates a region for objects that share a lifetime.
+ *
+ * Objects are carved out of blocks taken from the heap with a bump pointer,
+ * without locking, and are never freed individually. A region must not be
+ * used by two threads at the same time.
+ *
+ * @return allocator_arena_t* The new region, or NULL on failure.
+ */
+allocator_arena_t* allocator_arena_create(void);
+
+/**
+ * @brief Allocates a block of memory from a region.
+ *
+ * The block is aligned like allocator_malloc() memory and stays valid until
+ * the region is reset or destroyed. It must not be passed to allocator_free().
+ *
+ * @param arena The region to allocate from.
+ * @param size The size of the memory block in bytes.
+ * @return void* Pointer to the allocated memory, or NULL on failure or if arena is NULL.
+ */
+void* allocator_arena_malloc(allocator_arena_t* arena, size_t size);
+
+/**
+ * @brief Releases every object allocated from a region.
+ *
+ * The cost does not depend on the number of objects: the region rewinds to
+ * its first block and hands any other blocks back to the heap.
+ *
+ * @param arena The region to reset, or NULL.
+ */
+void allocator_arena_reset(allocator_arena_t* arena);
+
+/**
+ * @brief Releases every object allocated from a region, and the region itself.
+ *
+ * @param arena The region to destroy, or NULL.
+ */
+void allocator_arena_destroy(allocator_arena_t* arena);
+
+/**
+ * @brief Creates a pool of fixed-size objects.
+ *
+ * Objects are carved from chunks dedicated to the pool, without per-object
+ * headers, and recycled through a per-thread free list with a lock-free
+ * shared list behind it, so the heap's free bins are never searched.
+ * Objects may be freed by any thread.
+ *
+ * @param obj_size Size of each object in bytes, at most ALLOCATOR_MMAP_THRESHOLD.
+ * @param align Alignment of each object, a power of two, or 0 for the allocator_malloc() alignment.
+ * @return allocator_pool_t* The new pool, or NULL on failure or if an argument is unsupported.
+ */
+allocator_pool_t* allocator_pool_create(size_t obj_size, size_t align);
+
+/**
+ * @brief Allocates one object from a pool.
+ *
+ * @param pool The pool to allocate from.
+ * @return void* Pointer to the object, or NULL on failure or if pool is NULL.
+ */
+void* allocator_pool_alloc(allocator_pool_t* pool);
+
+/**
+ * @brief Returns an object to its pool.
+ *
+ * allocator_free() also accepts pool objects, at the cost of looking the
+ * pool up from the pointer.
+ *
+ * @param pool The pool the object was allocated from.
+ * @param ptr Pointer to the object, or NULL.
+ */
+void allocator_pool_free(allocator_pool_t* pool, void* ptr);
+
+/**
+ * @brief Destroys a pool and releases the memory of all of its objects.
+ *
+ * No thread may use the pool or its objects any more.
+ *
+ * @param pool The pool to destroy, or NULL.
+ */
+void allocator_pool_destroy(allocator_pool_t* pool);
+
+/**
+ * @brief Writes the heap profile collected so far.
+ *
+ * With the prof_sample setting above 0, each thread records the backtrace of
+ * an allocation roughly every prof_sample bytes, chosen at random so that
+ * allocations are sampled in proportion to their size. Allocations with an
+ * alignment above 16 bytes are not sampled. The file lists, for
+ * each backtrace, the sampled allocations that are still live and all those
+ * made since profiling started, in the legacy pprof heap format:
+ *
+ *     pprof --svg ./program mtalloc.1234.0.heap > heap.svg
+ *
+ * Addresses are symbolized from the process's memory map, which is appended
+ * to the file. allocator_destroy() discards the profile.
+ *
+ * @param path Name of the file to write.
+ * @return int Returns 0 on success, -1 if path is NULL or the file could not be written.
+ */
+int allocator_prof_dump(const char* path);
+
+/**
+ * @brief Starts recording allocation calls to a file.
+ *
+ * libmtalloc.so records every call to its malloc interface, and starts
+ * recording to the path in MTALLOC_RECORD when it is loaded. Each thread
+ * fills buffers of its own without locking, and a writer thread appends the
+ * full ones to the file. Replay the file with benchmarks/trace_replay.
+ *
+ * @param path File to create or truncate.
+ * @return int Returns 0 on success, -1 if recording is already on or the
+ *         file or writer thread cannot be created.
+ */
+int allocator_record_start(const char* path);
+
+/**
+ * @brief Stops recording, writes out every thread's buffer and closes the file.
+ *
+ * Calls still being recorded by other threads are waited for; calls that
+ * start afterwards are not recorded. A forked child never records.
+ *
+ * @return int Returns 0 on success, -1 if recording was off or writing failed.
+ */
+int allocator_record_stop(void);
+
+/**
+ * @brief Records one call while recording is on, and does nothing otherwise.
+ *
+ * Meant for layers that offer their own allocation interface on top of this
+ * one, as the malloc shim does. Record a free before releasing the block and
+ * an allocation after it returns. A realloc is recorded after it returns,
+ * with the clock read before it was called.
+ *
+ * @param op One of ALLOCATOR_RECORD_*.
+ * @param ptr Block returned, or the block being freed.
+ * @param old_ptr Block passed to realloc, NULL for other ops.
+ * @param size Requested bytes.
+ * @param alignment Requested alignment of ALLOCATOR_RECORD_ALIGNED, a power of two.
+ * @param begin_ns allocator_record_clock() before a realloc was called, 0 for other ops.
+ *        A realloc that began while recording was off is recorded as an allocation.
+ */
+void allocator_record_event(unsigned int op, const void* ptr, const void* old_ptr, size_t size, size_t alignment,
+                            uint64_t begin_ns);
+
+/**
+ * @brief Reads the clock that allocator_record_event() uses.
+ *
+ * @return uint64_t The time in nanoseconds, or 0 while recording is off.
+ */
+uint64_t allocator_record_clock(void);
+
+/**
+ * @brief Returns all unused heap memory to the OS.
+ *
+ * Flushes the calling thread's cache, unmaps chunks that are entirely free
+ * and releases the whole pages inside every other free block, regardless of
+ * how recently they were freed. Blocks cached by other threads are kept.
+ *
+ * @return size_t Number of bytes released.
+ */
+size_t allocator_trim(void);
+
+/**
+ * @brief Collects allocator statistics.
+ *
+ * Each thread counts its own activity without shared atomics; this call sums
+ * the counters of all live threads and of threads that have exited. Counts
+ * from threads that are running concurrently may be slightly behind.
+ *
+ * @param stats Pointer to the structure to fill in.
+ * @return int Returns 0 on success, -1 if stats is NULL.
+ */
+int allocator_get_stats(allocator_stats_t* stats);
+
+/**
+ * @brief Calls a function for every block of the heap.
+ *
+ * Arenas are walked one at a time, each under its own lock, so only threads
+ * bound to the arena being walked wait. Huge mappings follow. Pool objects
+ * are not reported. Blocks allocated or freed during the walk may or may not
+ * be seen.
+ *
+ * @param callback Function called for each block; see allocator_heap_walk_fn.
+ * @param ctx Passed through to callback.
+ * @return int 0 once every block was seen, the value that stopped the walk,
+ *         or -1 if callback is NULL.
+ */
+int allocator_heap_walk(allocator_heap_walk_fn callback, void* ctx);
+
+/**
+ * @brief Summarizes heap use and fragmentation with allocator_heap_walk().
+ *
+ * A high fragmentation ratio with much free memory means that free space is
+ * scattered in blocks too small for large requests.
+ *
+ * @param summary Pointer to the structure to fill in.
+ * @return int Returns 0 on success, -1 if summary is NULL.
+ */
+int allocator_heap_summary(allocator_heap_summary_t* summary);
+
+/**
+ * @brief Writes a readable heap report: the summary, then one line per mapping.
+ *
+ * Each mapping line gives its kind, owning arena, size and the share of it
+ * in use. Nothing is allocated, so this may be called from the shim.
+ *
+ * @param fd File descriptor to write to, e.g. 2 for stderr.
+ * @return int Returns 0 on success, -1 if a write failed.
+ */
+int allocator_heap_report(int fd);
+
+/**
+ * @brief Reads a percentile off a latency histogram.
+ *
+ * @param latency The histogram, e.g. from allocator_stats_t.
+ * @param percentile Percentile between 0 and 100, e.g. 99.9.
+ * @return uint64_t Upper bound in ns of the bucket holding the percentile,
+ *         or 0 if latency is NULL or empty.
+ */
+uint64_t allocator_latency_percentile(const allocator_latency_t* latency, double percentile);
+
+/**
+ * @brief Changes a run-time setting.
+ *
+ * The MTALLOC_CONF environment variable sets the same settings as name:value
+ * pairs separated by commas, e.g. MTALLOC_CONF=arenas:8,decay_ms:0. It is
+ * applied before the first allocation, and calls to this function override it.
+ * A pair whose value is malformed, too large for size_t or rejected by the
+ * limits below is ignored.
+ *
+ * - arenas: number of arenas, 0 for one per CPU. Only before the first allocation.
+ * - tcache_max: objects a thread cache bin holds before half of them are flushed, 1 to 4096.
+ * - decay_ms: milliseconds free pages stay resident, 0 to purge only in allocator_trim().
+ * - coalesce_defer: freed heap blocks each arena keeps unmerged for reuse,
+ *   0 to 1024, 0 to coalesce every free.
+ * - background_thread: 1 to have allocator_init() start a maintenance thread
+ *   that purges decayed pages and trims idle thread caches, 0 for none. A
+ *   running thread stops in allocator_destroy().
+ * - huge_pages: 0 for normal pages, 1 for transparent huge pages, 2 for MAP_HUGETLB.
+ * - mmap_threshold: allocations above this many bytes get their own mapping,
+ *   from 1024 up to the compiled-in ALLOCATOR_MMAP_THRESHOLD.
+ * - prof_sample: mean bytes allocated between heap profiler samples, 0 to stop
+ *   sampling. See allocator_prof_dump().
+ * - prof_signal: signal number that makes the process write a heap profile to
+ *   mtalloc.<pid>.<seq>.heap in its working directory, 0 for none.
+ *
+ * @param name Name of the setting.
+ * @param value New value.
+ * @return int Returns 0 on success, -1 if the name is unknown, the value is out
+ *         of range or the setting can no longer change.
+ */
+int allocator_config_set(const char* name, size_t value);
+
+/**
+ * @brief Reads a run-time setting.
+ *
+ * @param name Name of the setting, as for allocator_config_set().
+ * @param value Where the current value is stored.
+ * @return int Returns 0 on success, -1 if the name is unknown or an argument is NULL.
+ */
+int allocator_config_get(const char* name, size_t* value);
+
+/**
+ * @brief Returns the number of bytes usable in an allocated block.
+ *
+ * This is at least the size that was requested, and includes the slack left
+ * by rounding the request up to its size class.
+ *
+ * @param ptr Pointer to a block returned by the allocator, or NULL.
+ * @return size_t Usable size in bytes, or 0 if ptr is NULL.
+ */
+size_t allocator_usable_size(void* ptr);
+
+/**
+ * @brief Takes every allocator lock ahead of fork().
+ *
+ * Registered with pthread_atfork(), together with allocator_postfork_parent()
+ * and allocator_postfork_child(), when the allocator sets itself up, so that
+ * the child never inherits a lock held by a thread that does not exist
+ * there. Do not register them again.
+ */
+void allocator_prefork(void);
+
+/**
+ * @brief Releases the locks taken by allocator_prefork() in the parent.
+ */
+void allocator_postfork_parent(void);
+
+/**
+ * @brief Resets the locks taken by allocator_prefork() in the child.
+ */
+void allocator_postfork_child(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,268 @@
+/**
+ * @file allocator.hpp
+ * @brief C++ wrappers: an STL allocator and class-level operator new/delete.
+ *
+ * Both pick the small size class of an object from sizeof(T) at compile time
+ * and release it with the matching class, so node-based containers such as
+ * std::map and std::list go straight to the thread cache bin of their node
+ * size without rounding the size or looking the class up at run time:
+ *
+ *     std::map<int, int, std::less<int>, mtalloc::mt_allocator<std::pair<const int, int>>> map;
+ *
+ *     struct Node : mtalloc::mt_allocated<Node> { ... };
+ *
+ * Arrays, large objects and over-aligned types fall back to the general
+ * entry points. Requires C++11.
+ *
+ * MTALLOC_REPLACE_GLOBAL_NEW, expanded in exactly one source file, replaces
+ * the global operator new and delete as well. Their size is only known at
+ * run time, but sized delete still avoids looking up the block.
+ *
+ * @author Ameed Othman
+ * @date 14/10/2026
+ */
+
+#ifndef __ALLOCATOR_HPP__
+#define __ALLOCATOR_HPP__
+
+#include "allocator.h"
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+namespace mtalloc {
+
+/** @brief Largest object size served by a small size class. */
+constexpr std::size_t small_max = (std::size_t)ALLOCATOR_STATS_CLASSES * ALLOCATOR_CLASS_SPACING;
+
+/** @brief Alignment every size class guarantees. */
+constexpr std::size_t class_alignment = ALLOCATOR_CLASS_SPACING;
+
+/**
+ * @brief Returns the small size class that holds objects of a size.
+ *
+ * @param size Object size in bytes, at least 1.
+ * @return int The class for allocator_malloc_class(), or -1 if size is above small_max.
+ */
+constexpr int size_class(std::size_t size) noexcept {
+    return size <= small_max ? (int)((size + ALLOCATOR_CLASS_SPACING - 1) / ALLOCATOR_CLASS_SPACING) - 1 : -1;
+}
+
+/**
+ * @brief Allocates memory for one object whose size and alignment are known at compile time.
+ *
+ * @return void* Pointer to the memory, or nullptr on failure.
+ */
+template <std::size_t Size, std::size_t Align>
+inline void* allocate_fixed() noexcept {
+    static_assert(Size > 0, "objects have a nonzero size");
+    if (Align > class_alignment) {
+        return allocator_aligned_alloc(Align, Size);
+    }
+    if (size_class(Size) >= 0) {
+        return allocator_malloc_class((unsigned int)size_class(Size));
+    }
+    return allocator_malloc(Size);
+}
+
+/**
+ * @brief Frees memory from allocate_fixed() with the same Size and Align.
+ *
+ * @param ptr Pointer to the memory, or nullptr.
+ */
+template <std::size_t Size, std::size_t Align>
+inline void deallocate_fixed(void* ptr) noexcept {
+    if (Align > class_alignment) {
+        allocator_free(ptr);
+    } else if (size_class(Size) >= 0) {
+        allocator_free_class(ptr, (unsigned int)size_class(Size));
+    } else {
+        allocator_free_sized(ptr, Size);
+    }
+}
+
+/**
+ * @brief STL allocator backed by the allocator.
+ *
+ * allocate(1), which node-based containers call for every node, uses the
+ * size class of T fixed at compile time. Larger counts go through
+ * allocator_malloc() and are freed with allocator_free_sized(). Stateless:
+ * all instances compare equal.
+ */
+template <typename T>
+class mt_allocator {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    template <typename U>
+    struct rebind {
+        using other = mt_allocator<U>;
+    };
+
+    mt_allocator() noexcept = default;
+
+    template <typename U>
+    mt_allocator(const mt_allocator<U>&) noexcept {}
+
+    /**
+     * @brief Allocates uninitialized storage for n objects.
+     *
+     * @throws std::bad_array_new_length if n * sizeof(T) overflows.
+     * @throws std::bad_alloc if the allocator is out of memory.
+     */
+    T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* ptr;
+        if (n == 1) {
+            ptr = allocate_fixed<sizeof(T), alignof(T)>();
+        } else if (alignof(T) > class_alignment) {
+            ptr = allocator_aligned_alloc(alignof(T), n * sizeof(T));
+        } else {
+            ptr = allocator_malloc(n * sizeof(T));
+        }
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    /**
+     * @brief Releases storage from allocate() with the same n.
+     */
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        if (n == 1) {
+            deallocate_fixed<sizeof(T), alignof(T)>(ptr);
+        } else if (alignof(T) > class_alignment) {
+            allocator_free(ptr);
+        } else {
+            allocator_free_sized(ptr, n * sizeof(T));
+        }
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(const mt_allocator<T>&, const mt_allocator<U>&) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const mt_allocator<T>&, const mt_allocator<U>&) noexcept {
+    return false;
+}
+
+/**
+ * @brief Base class giving Derived an operator new and delete that use its size class.
+ *
+ * new Derived resolves the class of sizeof(Derived) at compile time. A class
+ * derived further from Derived is larger, so its size is checked at run time
+ * and it takes the general path.
+ */
+template <typename Derived>
+struct mt_allocated {
+    static void* operator new(std::size_t size) {
+        void* ptr = size == sizeof(Derived) ? allocate_fixed<sizeof(Derived), alignof(Derived)>()
+                                            : allocator_malloc(size);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+        return size == sizeof(Derived) ? allocate_fixed<sizeof(Derived), alignof(Derived)>()
+                                       : allocator_malloc(size);
+    }
+
+    static void operator delete(void* ptr, std::size_t size) noexcept {
+        if (size == sizeof(Derived)) {
+            deallocate_fixed<sizeof(Derived), alignof(Derived)>(ptr);
+        } else {
+            allocator_free(ptr);
+        }
+    }
+
+    // Called if a constructor throws after the nothrow form
+    static void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+        allocator_free(ptr);
+    }
+
+    static void* operator new[](std::size_t size) {
+        void* ptr = allocator_malloc(size ? size : 1);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static void operator delete[](void* ptr) noexcept {
+        allocator_free(ptr);
+    }
+};
+
+} // namespace mtalloc
+
+/**
+ * @brief Defines replacements for the global operator new and delete.
+ *
+ * Expand once, at namespace scope, in one source file of the program.
+ * Over-aligned forms (C++17) use allocator_aligned_alloc().
+ */
+#define MTALLOC_REPLACE_GLOBAL_NEW                                                              \
+    void* operator new(std::size_t size) {                                                      \
+        void* ptr = allocator_malloc(size ? size : 1);                                          \
+        if (ptr == nullptr) {                                                                   \
+            throw std::bad_alloc();                                                             \
+        }                                                                                       \
+        return ptr;                                                                             \
+    }                                                                                           \
+    void* operator new[](std::size_t size) { return operator new(size); }                      \
+    void* operator new(std::size_t size, const std::nothrow_t&) noexcept {                      \
+        return allocator_malloc(size ? size : 1);                                               \
+    }                                                                                           \
+    void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {                    \
+        return allocator_malloc(size ? size : 1);                                               \
+    }                                                                                           \
+    void operator delete(void* ptr) noexcept { allocator_free(ptr); }                           \
+    void operator delete[](void* ptr) noexcept { allocator_free(ptr); }                         \
+    void operator delete(void* ptr, std::size_t size) noexcept {                                \
+        allocator_free_sized(ptr, size ? size : 1);                                             \
+    }                                                                                           \
+    void operator delete[](void* ptr, std::size_t size) noexcept {                              \
+        allocator_free_sized(ptr, size ? size : 1);                                             \
+    }                                                                                           \
+    void operator delete(void* ptr, const std::nothrow_t&) noexcept { allocator_free(ptr); }    \
+    void operator delete[](void* ptr, const std::nothrow_t&) noexcept { allocator_free(ptr); }  \
+    MTALLOC_REPLACE_ALIGNED_NEW
+
+#if defined(__cpp_aligned_new)
+#define MTALLOC_REPLACE_ALIGNED_NEW                                                             \
+    void* operator new(std::size_t size, std::align_val_t align) {                              \
+        void* ptr = allocator_aligned_alloc(static_cast<std::size_t>(align), size ? size : 1);  \
+        if (ptr == nullptr) {                                                                   \
+            throw std::bad_alloc();                                                             \
+        }                                                                                       \
+        return ptr;                                                                             \
+    }                                                                                           \
+    void* operator new[](std::size_t size, std::align_val_t align) {                            \
+        return operator new(size, align);                                                       \
+    }                                                                                           \
+    void operator delete(void* ptr, std::align_val_t) noexcept { allocator_free(ptr); }         \
+    void operator delete[](void* ptr, std::align_val_t) noexcept { allocator_free(ptr); }       \
+    void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {                   \
+        allocator_free(ptr);                                                                    \
+    }                                                                                           \
+    void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {                 \
+        allocator_free(ptr);                                                                    \
+    }
+#else
+#define MTALLOC_REPLACE_ALIGNED_NEW
+#endif
+
+#endif
@@ -13,16 +13,353 @@
 #ifndef __ALLOCATOR_INTERNAL_H__
 #define __ALLOCATOR_INTERNAL_H__
 
+#include "allocator.h"
+#include "config.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
 
 // Data Structures
+
+/**
+ * @brief Boundary-tag header in front of every payload.
+ *
+ * Blocks in a chunk are laid out back to back, so the next block starts right
+ * after this payload and the previous one is prev_size bytes before this
+ * header. Both neighbours are found in O(1) without any list.
+ */
 typedef struct memory_block {
-    size_t size;               // Size of the memory block
-    int free;                  // Flag indicating if the block is free (1) or in use (0)
-    struct memory_block* next; // Pointer to the next memory block in the list
-    struct memory_block* prev; // Pointer to the previous memory block in the list
+    size_t prev_size;          // Payload size of the previous block in the chunk, 0 for the first
+    size_t size;               // Payload size, with the BLOCK_* flags in the low bits
 } memory_block_t;
 
+/** @brief Flag in memory_block_t::size: the block is free and sits in a bin. */
+#define BLOCK_FREE 0x1UL
+
+/**
+ * @brief Flag in memory_block_t::size: a free block whose payload is known to be zero.
+ *
+ * Only the free_links_t at the start of the payload may be non-zero. Set on
+ * the fresh block of a new chunk and kept through splits and merges of such
+ * blocks, so calloc() can skip clearing memory that was never written.
+ */
+#define BLOCK_ZERO 0x2UL
+
+/**
+ * @brief Flag in memory_block_t::size: an in-use block recorded by the heap profiler.
+ *
+ * Sampled allocations are always served from the heap, even small ones, so
+ * that freeing them is recognised from the header alone.
+ */
+#define BLOCK_SAMPLED 0x4UL
+
+/**
+ * @brief Flag in memory_block_t::size: a freed block on its arena's deferred list.
+ *
+ * The block is not coalesced yet, so its neighbours see it as in use, but a
+ * second free or a realloc() of it is rejected as for a free block.
+ */
+#define BLOCK_DEFERRED 0x8UL
+
+/** @brief All flag bits; payload sizes are multiples of ALIGNMENT so these are always clear. */
+#define BLOCK_FLAGS (BLOCK_FREE | BLOCK_ZERO | BLOCK_SAMPLED | BLOCK_DEFERRED)
+
+/** @brief Chunk kind: carved into boundary-tagged blocks. */
+#define CHUNK_HEAP 0
+
+/** @brief Chunk kind: split into SLABS_PER_CHUNK header-less slabs of small objects. */
+#define CHUNK_SLAB 1
+
+/** @brief Chunk kind: a dedicated mapping holding one allocation above ALLOCATOR_MMAP_THRESHOLD. */
+#define CHUNK_HUGE 2
+
+/** @brief Chunk kind: carved into the equally sized objects of one allocator_pool_create() pool. */
+#define CHUNK_POOL 3
+
+/** @brief Huge page mode: normal pages only. */
+#define HUGE_PAGES_OFF 0
+
+/** @brief Huge page mode: transparent huge pages requested with madvise(). */
+#define HUGE_PAGES_THP 1
+
+/** @brief Huge page mode: MAP_HUGETLB mappings, falling back to HUGE_PAGES_THP. */
+#define HUGE_PAGES_HUGETLB 2
+
+/**
+ * @brief Run-time settings, see allocator_config_set() for their meaning.
+ *
+ * All fields are size_t so that every setting is read and written the
+ * same way.
+ */
+typedef struct alloc_config {
+    size_t arenas;             // Arenas to create, 0 for one per CPU; fixed once they exist
+    size_t tcache_max;         // Objects a thread cache bin holds before it is flushed
+    size_t decay_ms;           // Milliseconds before free pages are purged, 0 to purge only on trim
+    size_t huge_pages;         // HUGE_PAGES_* mode for new mappings
+    size_t coalesce_defer;     // Freed heap blocks an arena holds back from coalescing, 0 for none
+    size_t background_thread;  // Non-zero to start the maintenance thread in allocator_init()
+    size_t mmap_threshold;     // Allocations above this many bytes get their own mapping
+    size_t prof_sample;        // Mean bytes allocated between profiler samples, 0 when off
+    size_t prof_signal;        // Signal that requests a profile dump, 0 for none
+} alloc_config_t;
+
+/** @brief Number of slabs in a slab chunk. */
+#define SLABS_PER_CHUNK 64
+
+/**
+ * @brief Header at the start of every mapping the allocator makes.
+ *
+ * Every mapping is aligned to ALLOCATOR_CHUNK_SIZE, so the header for any
+ * pointer the allocator hands out is found by masking the pointer.
+ */
+typedef struct heap_chunk {
+    size_t size;               // Size of the whole mapping, including this header
+    struct heap_chunk* next;   // Next chunk in the same arena, or on huge_list
+    struct heap_chunk* prev;   // Previous chunk in the same list
+    struct arena* arena;       // Arena that owns the chunk, NULL for huge and pool chunks
+    struct allocator_pool* pool; // Pool that owns the chunk (CHUNK_POOL)
+    int kind;                  // CHUNK_HEAP, CHUNK_SLAB, CHUNK_HUGE or CHUNK_POOL
+    unsigned int slabs_used;   // Slabs currently assigned to a size class (CHUNK_SLAB)
+    uint64_t emptied_at;       // Arena clock when slabs_used last dropped to 0 (CHUNK_SLAB)
+    size_t offset;             // Distance from the header to the payload (CHUNK_HUGE)
+    int sampled;               // Set when the allocation is recorded by the profiler (CHUNK_HUGE)
+} heap_chunk_t;
+
+/**
+ * @brief A run of equally sized small objects without per-object headers.
+ *
+ * The object size lives here, so freeing an object only needs its address.
+ * An empty slab is not bound to any size class and can be reused for any.
+ */
+typedef struct slab {
+    struct slab* next;         // Next slab in the same partial or empty list
+    struct slab* prev;         // Previous slab in the same list
+    void* free_list;           // Freed objects, linked through their first word
+    char* bump;                // First object that has never been handed out
+    char* end;                 // End of the slab's object area
+    uint32_t obj_size;         // Object size in bytes, 0 while the slab is empty
+    uint32_t used;             // Objects handed out and not yet freed
+    uint64_t freed_at;         // Arena clock when the slab last became empty
+    int purged;                // Set once an empty slab's pages went back to the OS
+} slab_t;
+
+/**
+ * @brief Header of a CHUNK_SLAB chunk: the common chunk header and its slab table.
+ */
+typedef struct slab_chunk {
+    heap_chunk_t header;
+    slab_t slabs[SLABS_PER_CHUNK];
+} slab_chunk_t;
+
+/**
+ * @brief Free bin links, stored in the payload of a free block.
+ */
+typedef struct free_links {
+    memory_block_t* next_free; // Next block in the same bin
+    memory_block_t* prev_free; // Previous block in the same bin
+    // The fields below are only kept for blocks in the large bins
+    uint64_t freed_at;         // Arena clock when the block entered its bin, in ms
+    int purged;                // Set once its pages have been returned to the OS
+} free_links_t;
+
+/** @brief Number of thread cache size classes (one per ALIGNMENT step). */
+#define TCACHE_NUM_BINS 64
+
+/** @brief Number of segregated free bins: exact small classes plus large size ranges. */
+#define NUM_BINS 128
+
+/** @brief Number of 64-bit words in an arena's non-empty bin bitmap. */
+#define BIN_MAP_WORDS ((NUM_BINS + 63) / 64)
+
+/**
+ * @brief An independent heap with its own lock, chunks, slabs and free bins.
+ *
+ * Threads are spread across arenas so that refills and medium-sized
+ * allocations from different threads rarely contend on the same lock.
+ */
+typedef struct arena {
+    pthread_mutex_t lock;           // Protects every field below
+    unsigned int index;             // Position in the arenas array
+    int node;                       // NUMA node its chunks are placed on
+    heap_chunk_t* chunks;           // Heap and slab chunks mapped by this arena
+    slab_t* slabs_partial[TCACHE_NUM_BINS]; // Slabs with objects left, by size class
+    slab_t* slabs_empty;            // Slabs not bound to a size class
+    memory_block_t* bins[NUM_BINS]; // Free blocks by size class, linked through their payload
+    uint64_t bin_map[BIN_MAP_WORDS]; // Bit i is set when bins[i] is not empty
+    size_t free_bytes;              // Payload bytes currently in the bins
+    uint64_t clock_ms;              // Monotonic time the arena was last locked, in ms
+    uint64_t next_purge_ms;         // Earliest time the next decay pass may run
+    memory_block_t* deferred;       // Freed blocks not coalesced yet, linked through their payload
+    size_t deferred_count;          // Blocks on the deferred list
+#if ALLOCATOR_TRACE
+    uint64_t locked_ns;             // When the current holder took the lock
+#endif
+    // Blocks freed by threads bound to other arenas, linked through their first
+    // payload word. Pushed without the lock, drained by the next allocation that
+    // holds it. Kept on its own cache line so remote pushes do not bounce the lock.
+    void* remote_free __attribute__((aligned(64)));
+} __attribute__((aligned(64))) arena_t;
+
+/**
+ * @brief A singly linked stack of cached blocks of one size class.
+ *
+ * Cached blocks stay marked in use from the shared heap's point of view; the
+ * link to the next cached block is stored in the first word of the payload.
+ */
+typedef struct tcache_bin {
+    void* head;                // Most recently cached payload pointer
+    unsigned int count;        // Number of payloads in this bin
+    unsigned int low_water;    // Fewest payloads held since the last background pass
+} tcache_bin_t;
+
+/** @brief Number of pools each thread keeps a free list for. */
+#define POOL_CACHE_SLOTS 8
+
+/**
+ * @brief A thread's free list for one pool, linked through the objects' first word.
+ *
+ * Slots are picked by pool id. A slot still holding the id of a destroyed
+ * pool is simply overwritten, so its objects are never touched again.
+ */
+typedef struct pool_cache {
+    uint64_t pool_id;          // Id of the pool cached here, 0 when unused
+    void* head;                // Most recently freed object
+    unsigned int count;        // Number of objects in the list
+} pool_cache_t;
+
+/**
+ * @brief A pool of fixed-size objects, created by allocator_pool_create().
+ *
+ * Objects are carved from dedicated CHUNK_POOL chunks and recycled through
+ * the per-thread pool caches, with shared_free as the fallback between
+ * threads. They carry no header and never go through the heap's bins.
+ */
+struct allocator_pool {
+    uint64_t id;                    // Unique and never reused, so stale cache slots are recognised
+    size_t obj_size;                // Object stride: the requested size rounded up to align
+    size_t align;                   // Object alignment
+    pthread_mutex_t lock;           // Protects chunks, bump and end
+    heap_chunk_t* chunks;           // CHUNK_POOL chunks mapped for this pool
+    char* bump;                     // First never-used object in the newest chunk
+    char* end;                      // End of the newest chunk
+    struct allocator_pool* next;    // Next live pool on pool_list
+    struct allocator_pool* prev;    // Previous live pool on pool_list
+    // Objects flushed by thread caches, linked through their first word.
+    // Pushed without a lock and taken whole by the next refill.
+    void* shared_free __attribute__((aligned(64)));
+};
+
+/** @brief Deepest backtrace kept for a profiler sample. */
+#define PROF_MAX_DEPTH 32
+
+/**
+ * @brief An allocation call site seen by the heap profiler, identified by its backtrace.
+ */
+typedef struct prof_site {
+    struct prof_site* next;    // Next site in the same hash bucket
+    uint64_t hash;             // Hash of the backtrace
+    int depth;                 // Frames in stack
+    void* stack[PROF_MAX_DEPTH]; // Return addresses, innermost first
+    uint64_t alloc_count;      // Sampled allocations since profiling started
+    uint64_t alloc_bytes;      // Requested bytes of those allocations
+    uint64_t live_count;       // Sampled allocations not freed yet
+    uint64_t live_bytes;       // Requested bytes of those allocations
+} prof_site_t;
+
+/**
+ * @brief A live sampled allocation, found by its address when it is freed.
+ */
+typedef struct prof_sample {
+    struct prof_sample* next;  // Next sample in the same hash bucket
+    void* ptr;                 // Payload address
+    size_t size;               // Requested size, aligned
+    prof_site_t* site;         // Where it was allocated
+} prof_sample_t;
+
+/**
+ * @brief Output buffer for profile dumps and heap reports, flushed with write(2) so nothing is allocated.
+ */
+typedef struct text_out {
+    int fd;                    // File being written
+    int failed;                // Set once a write has failed
+    size_t used;               // Bytes waiting in buf
+    char buf[4096];
+} text_out_t;
+
+/**
+ * @brief State of allocator_heap_summary() between callbacks.
+ */
+typedef struct heap_summary_ctx {
+    allocator_heap_summary_t* summary;
+    const void* mapping;       // Mapping of the previous block, to count each once
+} heap_summary_ctx_t;
+
+/**
+ * @brief State of allocator_heap_report() between callbacks: the mapping being totalled.
+ */
+typedef struct heap_report_ctx {
+    text_out_t* out;
+    allocator_heap_block_t first; // First block of the mapping, NULL mapping before any
+    size_t used;               // Bytes in use in the mapping
+    size_t free_blocks;        // Free heap blocks in the mapping
+    size_t largest_free;       // Largest of them
+} heap_report_ctx_t;
+
+/**
+ * @brief Activity counters kept by each thread for allocator_get_stats().
+ *
+ * Only the owning thread writes them, so updates are plain relaxed stores
+ * rather than shared atomic read-modify-writes.
+ */
+typedef struct tcache_stats {
+    uint64_t small_allocs[TCACHE_NUM_BINS]; // Allocations per small size class
+    uint64_t small_frees[TCACHE_NUM_BINS];  // Frees per small size class
+    uint64_t large_allocs;     // Heap allocations above the small classes
+    uint64_t large_frees;      // Heap frees above the small classes
+    uint64_t huge_allocs;      // Allocations given a dedicated mapping
+    uint64_t huge_frees;       // Frees of dedicated mappings
+    uint64_t bytes_allocated;  // Usable bytes handed out
+    uint64_t bytes_freed;      // Usable bytes given back
+    uint64_t cache_hits;       // Small allocations served from the cache
+    uint64_t cache_misses;     // Small allocations that needed a refill
+    uint64_t lock_contentions; // Arena lock acquisitions that had to wait
+#if ALLOCATOR_TRACE
+    allocator_latency_t lock_wait; // Arena lock waits
+    allocator_latency_t lock_hold; // Arena lock holds
+    allocator_latency_t os_map;    // Chunk mappings in extend_heap()
+#endif
+} tcache_stats_t;
+
+/**
+ * @brief Process-wide counters for calls into the OS, updated atomically on slow paths.
+ */
+typedef struct os_stats {
+    uint64_t mapped_bytes;     // Bytes currently mapped
+    uint64_t purged_bytes;     // Bytes released with madvise()
+    uint64_t mmap_calls;       // mmap() calls
+    uint64_t munmap_calls;     // munmap() calls
+    uint64_t mremap_calls;     // mremap() calls
+} os_stats_t;
+
+/**
+ * @brief Per-thread cache of small blocks sitting in front of the shared heap.
+ */
+typedef struct tcache {
+    tcache_bin_t bins[TCACHE_NUM_BINS]; // Cached blocks, indexed by size class
+    pool_cache_t pools[POOL_CACHE_SLOTS]; // Free lists of recently used pools, by pool id
+    int64_t prof_countdown;    // Bytes left to allocate before the profiler looks again
+    uint64_t prof_seed;        // State of the sampling interval generator
+    int prof_busy;             // Set while the profiler runs, so its own allocations are not sampled
+    struct arena* arena;       // Arena this thread refills from and allocates in
+    unsigned int contended;    // Consecutive contended acquisitions of that arena
+    unsigned long generation;  // Heap generation the cached blocks belong to
+    unsigned long gc_epoch;    // Background pass whose unused blocks were last released
+    int registered;            // Set once the thread exit destructor is armed
+    tcache_stats_t stats;      // This thread's activity counters
+    struct tcache* stats_next; // Next live thread in the stats registry
+    struct tcache* stats_prev; // Previous live thread in the stats registry
+} tcache_t;
+
 // Helper Function Prototypes
 
 /**
@@ -34,29 +371,42 @@ typedef struct memory_block {
 static size_t align_size(size_t size);
 
 /**
- * @brief Extends the heap by allocating a new memory block.
+ * @brief Extends an arena by mapping a new chunk and returning it as one block.
  *
- * @param last Pointer to the last memory block in the current list.
- * @param size The size of the new memory block in bytes.
+ * The chunk is ALLOCATOR_CHUNK_SIZE bytes and aligned to its size, so the
+ * owning chunk of any block is found by masking its address. The block is
+ * followed by an in-use fence header of size 0 that stops coalescing at the
+ * end of the chunk. The caller splits the requested size off the front and
+ * the remainder goes to the free bins.
+ *
+ * @param arena Pointer to the arena to extend.
+ * @param size The minimum payload size of the new block in bytes.
  * @return memory_block_t* Pointer to the newly allocated memory block, or NULL on failure.
  */
-static memory_block_t* extend_heap(memory_block_t* last, size_t size);
+static memory_block_t* extend_heap(arena_t* arena, size_t size);
 
 /**
  * @brief Finds a free memory block of at least the specified size.
  *
+ * Small sizes are answered in O(1) from their exact bin; large sizes scan only
+ * their own bin before taking the first non-empty higher bin from bin_map.
+ *
+ * @param arena Pointer to the arena to search.
  * @param size The size of the memory block to find.
  * @return memory_block_t* Pointer to the found memory block, or NULL if no suitable block is found.
  */
-static memory_block_t* find_block(size_t size);
+static memory_block_t* find_block(arena_t* arena, size_t size);
 
 /**
  * @brief Splits a memory block into two blocks if the block is larger than the requested size.
  *
+ * The tail becomes a free block and is coalesced with the block after it.
+ *
+ * @param arena Pointer to the arena owning the block.
  * @param block Pointer to the memory block to be split.
  * @param size The size of the first block after splitting.
  */
-static void split_block(memory_block_t* block, size_t size);
+static void split_block(arena_t* arena, memory_block_t* block, size_t size);
 
 /**
  * @brief Retrieves the memory block metadata for a given memory pointer.
@@ -75,10 +425,743 @@ static memory_block_t* get_block(void* ptr);
 static int valid_block(memory_block_t* block);
 
 /**
- * @brief Merges adjacent free memory blocks into a single block to reduce fragmentation.
+ * @brief Returns the payload size of a block without its flag bits.
+ *
+ * @param block Pointer to the memory block.
+ * @return size_t The payload size in bytes.
+ */
+static size_t block_size(memory_block_t* block);
+
+/**
+ * @brief Returns the block physically following a heap block in its chunk.
  *
+ * @param block Pointer to a heap block; the last block is followed by the chunk's fence.
+ * @return memory_block_t* Pointer to the next block.
+ */
+static memory_block_t* next_block(memory_block_t* block);
+
+/**
+ * @brief Returns the block physically preceding a heap block in its chunk.
+ *
+ * @param block Pointer to a heap block whose prev_size is not 0.
+ * @return memory_block_t* Pointer to the previous block.
+ */
+static memory_block_t* prev_block(memory_block_t* block);
+
+/**
+ * @brief Merges a free block with its free physical neighbours and bins the result.
+ *
+ * Neighbours come from the boundary tags, so this is O(1) and never crosses
+ * a chunk boundary.
+ *
+ * @param arena Pointer to the arena owning the block.
  * @param block Pointer to the memory block to be merged.
  */
-static void merge_blocks(memory_block_t* block);
+static void merge_blocks(arena_t* arena, memory_block_t* block);
+
+/**
+ * @brief Keeps BLOCK_ZERO on a merged block only if both halves were known-zero.
+ *
+ * @param block Pointer to the surviving block, already grown over absorbed.
+ * @param absorbed Pointer to the header of the block that was merged into it.
+ */
+static void merge_zero(memory_block_t* block, memory_block_t* absorbed);
+
+/**
+ * @brief Maps a size to its free bin, which is also its thread cache bin for small sizes.
+ *
+ * @param size The aligned size.
+ * @return size_t The bin index.
+ */
+static size_t bin_index(size_t size);
+
+/**
+ * @brief Pushes a free block onto the bin for its size.
+ *
+ * @param arena Pointer to the arena owning the block.
+ * @param block Pointer to the free block.
+ */
+static void bin_insert(arena_t* arena, memory_block_t* block);
+
+/**
+ * @brief Unlinks a free block from its bin.
+ *
+ * @param arena Pointer to the arena owning the block.
+ * @param block Pointer to a block currently in a bin.
+ */
+static void bin_remove(arena_t* arena, memory_block_t* block);
+
+/**
+ * @brief Takes a block of at least size bytes from an arena.
+ *
+ * The caller must hold the arena's lock.
+ *
+ * @param arena Pointer to the arena to allocate from.
+ * @param size The aligned payload size.
+ * @param zeroed If not NULL, set to 1 when the payload past its first
+ *        sizeof(free_links_t) bytes is known to be zero, 0 otherwise.
+ * @return memory_block_t* Pointer to the block, or NULL if the arena could not be extended.
+ */
+static memory_block_t* heap_alloc_block(arena_t* arena, size_t size, int* zeroed);
+
+/**
+ * @brief Allocates a block whose payload is aligned beyond ALIGNMENT.
+ *
+ * Over-allocates by the alignment, then returns the padding in front of the
+ * aligned payload and any excess behind it to the bins. The caller must hold
+ * the arena's lock.
+ *
+ * @param arena Pointer to the arena to allocate from.
+ * @param alignment Required payload alignment, a power of two above ALIGNMENT.
+ * @param size The aligned payload size.
+ * @return memory_block_t* Pointer to the block, or NULL if the arena could not be extended.
+ */
+static memory_block_t* heap_alloc_aligned(arena_t* arena, size_t alignment, size_t size);
+
+/**
+ * @brief Returns an in-use block to its arena and coalesces it.
+ *
+ * With the coalesce_defer setting above 0 the block goes onto the arena's
+ * deferred list instead, which is coalesced as a batch once it is full.
+ * The caller must hold the arena's lock.
+ *
+ * @param arena Pointer to the arena owning the block.
+ * @param block Pointer to the block being released.
+ */
+static void heap_free_block(arena_t* arena, memory_block_t* block);
+
+/**
+ * @brief Takes a block of about the requested size off an arena's deferred list.
+ *
+ * Blocks up to a quarter larger than size are accepted; the caller splits off the rest.
+ * The caller must hold the arena's lock.
+ *
+ * @param arena Pointer to the arena.
+ * @param size The aligned payload size needed.
+ * @return memory_block_t* The block, now in use, or NULL if none fits.
+ */
+static memory_block_t* heap_defer_take(arena_t* arena, size_t size);
+
+/**
+ * @brief Coalesces every block on an arena's deferred list into the free bins.
+ *
+ * The caller must hold the arena's lock.
+ *
+ * @param arena Pointer to the arena.
+ */
+static void heap_defer_flush(arena_t* arena);
+
+/**
+ * @brief Grows an in-use block in place by absorbing the free block after it.
+ *
+ * Whatever the request does not need is split off again and returned to the
+ * bins. The caller must hold the arena's lock.
+ *
+ * @param arena Pointer to the arena owning the block.
+ * @param block Pointer to the in-use block.
+ * @param size The new aligned payload size, larger than the current one.
+ * @return int Returns 1 if the block now holds size bytes, 0 if it must be moved.
+ */
+static int heap_grow_block(arena_t* arena, memory_block_t* block, size_t size);
+
+/**
+ * @brief Maps an ALLOCATOR_CHUNK_SIZE-aligned region for a new chunk.
+ *
+ * Backs the region with huge pages according to the huge_pages setting.
+ *
+ * @param size The size of the region, a multiple of the page size.
+ * @return void* Pointer to the region, or NULL on failure.
+ */
+static void* chunk_map(size_t size);
+
+/**
+ * @brief Pushes a chunk onto the front of a doubly linked chunk list.
+ *
+ * @param list Pointer to the list head.
+ * @param chunk Pointer to the chunk to link.
+ */
+static void chunk_link(heap_chunk_t** list, heap_chunk_t* chunk);
+
+/**
+ * @brief Removes a chunk from the doubly linked chunk list it is on.
+ *
+ * @param list Pointer to the list head.
+ * @param chunk Pointer to the chunk to unlink.
+ */
+static void chunk_unlink(heap_chunk_t** list, heap_chunk_t* chunk);
+
+/**
+ * @brief Returns the slab holding a small object.
+ *
+ * @param ptr Pointer into a CHUNK_SLAB chunk.
+ * @return slab_t* Pointer to the slab's entry in its chunk's slab table.
+ */
+static slab_t* ptr_slab(void* ptr);
+
+/**
+ * @brief Maps a new slab chunk and puts all of its slabs on the empty list.
+ *
+ * @param arena Pointer to the arena, which must be locked by the caller.
+ * @return int Returns 0 on success, -1 if the chunk could not be mapped.
+ */
+static int slab_chunk_create(arena_t* arena);
+
+/**
+ * @brief Hands out one object of a small size class.
+ *
+ * Takes from the first partial slab of the class, binding an empty slab to
+ * the class when there is none.
+ *
+ * @param arena Pointer to the arena, which must be locked by the caller.
+ * @param size The aligned object size, at most TCACHE_MAX_SIZE.
+ * @return void* Pointer to the object, or NULL if no slab could be mapped.
+ */
+static void* slab_alloc(arena_t* arena, size_t size);
+
+/**
+ * @brief Returns a small object to its slab, releasing the slab once it is empty.
+ *
+ * @param arena Pointer to the arena owning the slab, locked by the caller.
+ * @param ptr Pointer to the object.
+ */
+static void slab_free(arena_t* arena, void* ptr);
+
+/**
+ * @brief Frees a slab object or heap block owned by a locked arena.
+ *
+ * @param arena Pointer to the owning arena, locked by the caller.
+ * @param ptr Payload pointer returned by allocator_malloc().
+ */
+static void arena_release(arena_t* arena, void* ptr);
+
+/**
+ * @brief Returns the calling thread's free list for a pool.
+ *
+ * A slot that belonged to another pool is flushed and taken over.
+ *
+ * @param tc Pointer to the calling thread's cache.
+ * @param pool Pointer to the pool.
+ * @return pool_cache_t* Pointer to the slot, now holding pool's id.
+ */
+static pool_cache_t* pool_cache(tcache_t* tc, allocator_pool_t* pool);
+
+/**
+ * @brief Fills an empty thread free list for a pool.
+ *
+ * Takes everything on the pool's shared list if there is anything, and
+ * otherwise carves TCACHE_BATCH fresh objects under the pool lock.
+ *
+ * @param pool Pointer to the pool.
+ * @param pc Pointer to the calling thread's slot for the pool.
+ * @return unsigned int Number of objects added, 0 if no chunk could be mapped.
+ */
+static unsigned int pool_refill(allocator_pool_t* pool, pool_cache_t* pc);
+
+/**
+ * @brief Maps a new chunk for a pool and makes it the one objects are carved from.
+ *
+ * @param pool Pointer to the pool, whose lock the caller holds.
+ * @return int Returns 0 on success, -1 if the chunk could not be mapped.
+ */
+static int pool_chunk_create(allocator_pool_t* pool);
+
+/**
+ * @brief Pushes a chain of objects onto a pool's shared free list.
+ *
+ * Lock-free and safe to call from any thread.
+ *
+ * @param pool Pointer to the pool that owns every object in the chain.
+ * @param head First object of the chain.
+ * @param tail Last object of the chain; its link is overwritten.
+ */
+static void pool_push_shared(allocator_pool_t* pool, void* head, void* tail);
+
+/**
+ * @brief Empties a thread free list back into its pool and frees the slot.
+ *
+ * The pool is looked up by id on pool_list, so the objects of a pool that
+ * has been destroyed in the meantime are dropped without being touched.
+ *
+ * @param pc Pointer to the slot.
+ */
+static void pool_cache_flush(pool_cache_t* pc);
+
+/**
+ * @brief Slow path of allocator_malloc(), taken when the profiler countdown runs out.
+ *
+ * Re-arms the countdown from the prof_sample setting and, when profiling is
+ * on, serves the request with a sampled allocation whose backtrace is
+ * recorded. Also writes a profile requested by the prof_signal signal.
+ *
+ * @param tc Pointer to the calling thread's cache.
+ * @param size The aligned request size.
+ * @return void* Pointer to the allocated memory, or NULL on failure.
+ */
+static void* prof_malloc(tcache_t* tc, size_t size);
+
+/**
+ * @brief Writes the profile requested by the prof_signal signal, if any.
+ *
+ * @param tc Pointer to the calling thread's cache; nothing is written while its profiler is busy.
+ */
+static void prof_dump_pending(tcache_t* tc);
+
+/**
+ * @brief Draws the next sampling interval, exponentially distributed around a mean.
+ *
+ * @param tc Pointer to the calling thread's cache, which holds the generator state.
+ * @param mean Mean interval in bytes.
+ * @return int64_t Bytes to allocate before the next sample, at least 1.
+ */
+static int64_t prof_next_interval(tcache_t* tc, size_t mean);
+
+/**
+ * @brief Records a sampled allocation under its call site.
+ *
+ * @param ptr Payload address.
+ * @param size Requested size.
+ * @param stack Backtrace of the allocation, innermost frame first.
+ * @param depth Number of frames in stack.
+ */
+static void prof_record(void* ptr, size_t size, void** stack, int depth);
+
+/**
+ * @brief Forgets a sampled allocation that is being freed.
+ *
+ * @param ptr Payload address.
+ */
+static void prof_forget(void* ptr);
+
+/**
+ * @brief Updates a sampled allocation that realloc() resized or moved.
+ *
+ * @param old_ptr Payload address before the call.
+ * @param new_ptr Payload address after the call.
+ * @param size New requested size.
+ */
+static void prof_resize(void* old_ptr, void* new_ptr, size_t size);
+
+/**
+ * @brief Writes out the bytes buffered in a text output buffer.
+ *
+ * @param out Pointer to the buffer; failed is set if a write fails.
+ */
+static void text_flush(text_out_t* out);
+
+/**
+ * @brief Appends formatted text to a text output buffer, flushing it first when nearly full.
+ *
+ * A single call must produce less than 256 bytes.
+ *
+ * @param out Pointer to the buffer.
+ * @param format printf-style format string.
+ */
+static void text_printf(text_out_t* out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Writes the profile in the legacy pprof heap format to an open file.
+ *
+ * @param fd File descriptor to write to.
+ * @return int Returns 0 on success, -1 if a write failed.
+ */
+static int prof_write(int fd);
+
+/**
+ * @brief Creates the pools that hold profiler records, unless they exist.
+ *
+ * Called without prof_mutex held, since creating a pool allocates from an arena.
+ *
+ * @return int Returns 0 on success, -1 if a pool could not be created.
+ */
+static int prof_pools_init(void);
+
+/**
+ * @brief Signal handler for the prof_signal setting: asks for a profile dump.
+ *
+ * Only sets a flag, since dumping takes locks; the dump is written by the
+ * next allocation that reaches prof_malloc().
+ */
+static void prof_signal_handler(int sig);
+
+/**
+ * @brief Changes one setting after checking its value.
+ *
+ * @param name Setting name, not necessarily NUL-terminated.
+ * @param len Length of name.
+ * @param value New value.
+ * @return int Returns 0 on success, -1 if the name is unknown, the value is
+ *         out of range or the setting can no longer change.
+ */
+static int config_apply(const char* name, size_t len, size_t value);
+
+/**
+ * @brief Applies the settings in the MTALLOC_CONF environment variable, once.
+ *
+ * Parsed by hand, without allocating, since this runs before the allocator
+ * is ready to serve libc.
+ */
+static void config_load_env(void);
+
+/**
+ * @brief Sizes the arena array from the CPU and NUMA node counts and initializes the arena locks.
+ *
+ * The arena count is a multiple of the node count, and arena i is placed
+ * on node i % node_count. Also caches the page size, maps a slab chunk for
+ * the arena the calling thread binds to and registers the fork handlers.
+ */
+static void arena_setup(void);
+
+/**
+ * @brief Picks an arena on a node for a thread's first allocation, round-robin.
+ *
+ * @param node NUMA node, below node_count.
+ * @return arena_t* Pointer to the chosen arena.
+ */
+static arena_t* arena_for_node(int node);
+
+/**
+ * @brief Locks the calling thread's arena, moving the thread to another arena
+ * when its own keeps being contended, and drains its remote free list.
+ *
+ * @param tc Pointer to the calling thread's cache, which records the binding.
+ * @return arena_t* Pointer to the locked arena.
+ */
+static arena_t* arena_acquire(tcache_t* tc);
+
+/**
+ * @brief Pushes a chain of freed payloads onto an arena's remote free list.
+ *
+ * Lock-free and safe to call from any thread; the blocks stay marked in use
+ * until the owning arena drains them.
+ *
+ * @param arena Pointer to the arena that owns every block in the chain.
+ * @param head First payload pointer of the chain.
+ * @param tail Last payload pointer of the chain; its link is overwritten.
+ */
+static void arena_remote_push(arena_t* arena, void* head, void* tail);
+
+/**
+ * @brief Returns every block on the arena's remote free list to its bins.
+ *
+ * @param arena Pointer to the arena, which must be locked by the caller.
+ */
+static void arena_drain_remote(arena_t* arena);
+
+/**
+ * @brief Counts the NUMA nodes listed in /sys/devices/system/node/online.
+ *
+ * The file is read with plain system calls, since this runs before the
+ * allocator is ready to serve libc.
+ *
+ * @return unsigned int Highest online node plus one, or 1 if the topology is unknown.
+ */
+static unsigned int numa_node_count(void);
+
+/**
+ * @brief Returns the NUMA node of the CPU the calling thread runs on.
+ *
+ * @return int Node number below node_count, 0 if it cannot be determined.
+ */
+static int numa_current_node(void);
+
+/**
+ * @brief Places a range on a NUMA node with mbind(), moving pages already touched.
+ *
+ * Does nothing on single-node hosts. Failures are ignored: the range then
+ * simply follows the default first-touch policy.
+ *
+ * @param addr Start of the range, page-aligned.
+ * @param size Length of the range in bytes.
+ * @param node NUMA node to prefer.
+ */
+static void numa_bind(void* addr, size_t size, int node);
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in milliseconds.
+ */
+static uint64_t now_ms(void);
+
+/**
+ * @brief Advances the arena clock and purges pages that have decayed.
+ *
+ * Called whenever the arena is locked; runs a purge pass at most once per
+ * ALLOCATOR_DECAY_MS, and never while the background thread runs.
+ *
+ * @param arena Pointer to the arena, which must be locked by the caller.
+ */
+static void arena_decay(arena_t* arena);
+
+/**
+ * @brief Releases free memory that has been unused since the given time.
+ *
+ * Entirely free chunks are unmapped; other free blocks have the whole pages
+ * past their bin links released with madvise(), as do empty slabs.
+ *
+ * @param arena Pointer to the arena, which must be locked by the caller.
+ * @param cutoff Only blocks that entered their bin at or before this arena time are purged.
+ * @return size_t Number of bytes released.
+ */
+static size_t arena_purge(arena_t* arena, uint64_t cutoff);
+
+/**
+ * @brief Unmaps the heap chunk backing a free block that spans the whole chunk.
+ *
+ * @param arena Pointer to the arena owning the chunk, locked by the caller.
+ * @param block Pointer to the free block covering the chunk.
+ * @return size_t Size of the unmapped chunk in bytes.
+ */
+static size_t chunk_release(arena_t* arena, memory_block_t* block);
+
+/**
+ * @brief Unmaps a slab chunk whose slabs are all empty.
+ *
+ * @param arena Pointer to the arena owning the chunk, locked by the caller.
+ * @param chunk Pointer to the slab chunk.
+ * @return size_t Size of the unmapped chunk in bytes.
+ */
+static size_t slab_chunk_release(arena_t* arena, heap_chunk_t* chunk);
+
+/**
+ * @brief Maps a dedicated region for an allocation above ALLOCATOR_MMAP_THRESHOLD.
+ *
+ * @param size The aligned payload size.
+ * @param alignment Required payload alignment, a power of two below ALLOCATOR_CHUNK_SIZE.
+ * @return void* Pointer to the payload, the first aligned address past the
+ *         CHUNK_HUGE header, or NULL on failure.
+ */
+static void* huge_alloc(size_t size, size_t alignment);
+
+/**
+ * @brief Unmaps a mapping created by huge_alloc().
+ *
+ * @param chunk Pointer to the mapping's header.
+ */
+static void huge_free(heap_chunk_t* chunk);
+
+/**
+ * @brief Resizes a mapping with mremap(), moving pages rather than copying.
+ *
+ * A mapping that cannot grow in place is moved into a fresh aligned window,
+ * so its header stays reachable by masking the payload address.
+ *
+ * @param chunk Pointer to the mapping's header.
+ * @param size The new aligned payload size, above ALLOCATOR_MMAP_THRESHOLD.
+ * @return void* Pointer to the resized payload, or NULL if the caller must copy instead.
+ */
+static void* huge_realloc(heap_chunk_t* chunk, size_t size);
+
+/**
+ * @brief Locks an arena, counting the acquisition as contended if it had to wait.
+ *
+ * @param tc Pointer to the calling thread's cache, which holds its counters.
+ * @param arena Pointer to the arena to lock.
+ */
+static void arena_lock(tcache_t* tc, arena_t* arena);
+
+/**
+ * @brief Unlocks an arena taken with arena_acquire() or arena_lock().
+ *
+ * @param tc Pointer to the calling thread's cache, which holds its counters.
+ * @param arena Pointer to the arena to unlock.
+ */
+static void arena_unlock(tcache_t* tc, arena_t* arena);
+
+/**
+ * @brief Maps anonymous memory and records it in the OS counters.
+ *
+ * @param size The size of the mapping in bytes.
+ * @param flags Extra mmap() flags, such as MAP_HUGETLB.
+ * @return void* Pointer to the mapping, or NULL on failure.
+ */
+static void* os_map(size_t size, int flags);
+
+/**
+ * @brief Unmaps memory and records it in the OS counters.
+ *
+ * @param addr Start of the range to unmap.
+ * @param size The size of the range in bytes.
+ */
+static void os_unmap(void* addr, size_t size);
+
+/**
+ * @brief Releases the pages of a range with madvise() and records it in the OS counters.
+ *
+ * @param addr Page-aligned start of the range.
+ * @param size The size of the range in bytes, a multiple of the page size.
+ * @return size_t The number of bytes released, 0 if madvise() failed.
+ */
+static size_t os_purge(void* addr, size_t size);
+
+/**
+ * @brief Adds one thread's counters into a stats snapshot.
+ *
+ * @param stats Pointer to the snapshot being filled in.
+ * @param counters Pointer to the thread's counters.
+ */
+static void stats_merge(allocator_stats_t* stats, tcache_stats_t* counters);
+
+/**
+ * @brief Walks the heap and slab chunks of one arena for allocator_heap_walk().
+ *
+ * @param arena Pointer to the arena, whose lock the caller holds.
+ * @param callback Function called for each block.
+ * @param ctx Passed through to callback.
+ * @return int 0 once every block was seen, or the value that stopped the walk.
+ */
+static int heap_walk_arena(arena_t* arena, allocator_heap_walk_fn callback, void* ctx);
+
+/**
+ * @brief allocator_heap_walk() callback that adds a block to a heap_summary_ctx_t.
+ */
+static int heap_summary_add(const allocator_heap_block_t* block, void* ctx);
+
+/**
+ * @brief allocator_heap_walk() callback that totals a mapping for a heap_report_ctx_t.
+ *
+ * Writes the line of the previous mapping when a new one starts.
+ */
+static int heap_report_add(const allocator_heap_block_t* block, void* ctx);
+
+/**
+ * @brief Writes the report line of the mapping a heap_report_ctx_t has totalled.
+ *
+ * @param report Pointer to the report state.
+ */
+static void heap_report_mapping(heap_report_ctx_t* report);
+
+/**
+ * @brief Returns the largest duration counted by a latency histogram bucket.
+ *
+ * @param index Bucket index.
+ * @return uint64_t Upper bound in nanoseconds, UINT64_MAX for the last bucket.
+ */
+static uint64_t latency_bucket_limit(size_t index);
+
+/**
+ * @brief Reads the clock used for tracing.
+ *
+ * @return uint64_t Monotonic time in ns, or 0 when built without ALLOCATOR_TRACE.
+ */
+static uint64_t trace_now_ns(void);
+
+#if ALLOCATOR_TRACE
+/**
+ * @brief Returns the latency histogram bucket counting a duration.
+ *
+ * @param ns Duration in nanoseconds.
+ * @return size_t Bucket index, below ALLOCATOR_LATENCY_BUCKETS.
+ */
+static size_t latency_bucket(uint64_t ns);
+
+/**
+ * @brief Adds a duration to one of the calling thread's latency histograms.
+ *
+ * @param latency Pointer to the histogram, owned by the calling thread.
+ * @param ns Duration in nanoseconds.
+ */
+static void trace_record(allocator_latency_t* latency, uint64_t ns);
+#endif
+
+/**
+ * @brief Records an arena lock acquisition and starts timing the hold.
+ *
+ * Does nothing when built without ALLOCATOR_TRACE.
+ *
+ * @param tc Pointer to the calling thread's cache, which holds its counters.
+ * @param arena Pointer to the arena, now locked by the caller.
+ * @param wait_start trace_now_ns() before blocking on the lock, or 0 if it was free.
+ */
+static void trace_lock_acquired(tcache_t* tc, arena_t* arena, uint64_t wait_start);
+
+/**
+ * @brief Returns the calling thread's cache, resetting it after allocator_destroy().
+ *
+ * @return tcache_t* Pointer to the thread-local cache.
+ */
+static tcache_t* tcache_get(void);
+
+/**
+ * @brief Takes an object of a small size class from the thread cache, refilling the bin if empty.
+ *
+ * @param tc Pointer to the calling thread's cache.
+ * @param index The size class.
+ * @param size The class size, (index + 1) * ALIGNMENT.
+ * @return void* Pointer to the object, or NULL if the heap is exhausted.
+ */
+static void* tcache_alloc(tcache_t* tc, size_t index, size_t size);
+
+/**
+ * @brief Refills an empty bin with a batch of slab objects under a single lock.
+ *
+ * @param tc Pointer to the thread cache owning the bin.
+ * @param bin Pointer to the bin to refill.
+ * @param size The class size of the bin.
+ * @return int Returns the number of blocks added, 0 if the heap is exhausted.
+ */
+static int tcache_refill(tcache_t* tc, tcache_bin_t* bin, size_t size);
+
+/**
+ * @brief Caches a freed slab object, flushing a batch first if its bin is full.
+ *
+ * @param tc Pointer to the calling thread's cache.
+ * @param ptr Pointer to the object being freed.
+ * @param size The object's class size.
+ */
+static void tcache_put(tcache_t* tc, void* ptr, size_t size);
+
+/**
+ * @brief Returns up to count cached blocks from a bin to their arenas.
+ *
+ * Consecutive blocks owned by the same arena are released under one lock.
+ *
+ * @param tc Pointer to the thread cache owning the bin.
+ * @param index Size class index of the bin to drain.
+ * @param count Maximum number of blocks to release.
+ */
+static void tcache_flush(tcache_t* tc, size_t index, unsigned int count);
+
+/**
+ * @brief Releases the cached blocks each bin went without since the last background pass.
+ *
+ * Three quarters of a bin's low-water mark are flushed, so bins of classes
+ * the thread stopped using drain over a few passes.
+ *
+ * @param tc Pointer to the calling thread's cache.
+ */
+static void tcache_gc(tcache_t* tc);
+
+/**
+ * @brief Thread exit destructor that hands the thread's cached blocks back to their arenas.
+ *
+ * @param arg Pointer to the exiting thread's cache.
+ */
+static void tcache_thread_exit(void* arg);
+
+/**
+ * @brief Starts the background thread unless it is already running.
+ *
+ * @return int Returns 0 on success, -1 if the thread could not be created.
+ */
+static int background_start(void);
+
+/**
+ * @brief Stops the background thread and waits for it to exit, if it runs.
+ */
+static void background_stop(void);
+
+/**
+ * @brief Body of the background thread: runs a pass every ALLOCATOR_BACKGROUND_INTERVAL_MS until stopped.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void* background_main(void* arg);
+
+/**
+ * @brief Drains remote frees and purges decayed pages in every arena, then starts a new cache epoch.
+ *
+ * Also writes a profile requested by the prof_signal signal.
+ */
+static void background_pass(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,159 @@
+/**
+ * @file config.h
+ * @brief Compile-time configuration for the memory allocator.
+ *
+ * Each setting can be overridden by defining it on the compiler command line,
+ * e.g. -DALLOCATOR_CHUNK_SIZE=16777216. Settings marked as defaults can also
+ * be changed at run time through MTALLOC_CONF or allocator_config_set().
+ *
+ * @author Ameed Othman
+ * @date 30/11/2024
+ */
+
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+/**
+ * @brief Size in bytes of each chunk the heap maps from the OS.
+ *
+ * The heap grows one chunk at a time and carves blocks out of it, so small
+ * allocations share pages instead of each costing an mmap. Requests larger
+ * than ALLOCATOR_MMAP_THRESHOLD get a mapping of their own. Chunks are
+ * aligned to their size, so this must be a power of two; sensible values
+ * range from 1 MiB to 64 MiB.
+ */
+#ifndef ALLOCATOR_CHUNK_SIZE
+#define ALLOCATOR_CHUNK_SIZE (4UL * 1024 * 1024)
+#endif
+
+/**
+ * @brief Allocations above this many bytes bypass the heap and get their own mapping.
+ *
+ * Such blocks are returned to the OS as soon as they are freed and, on Linux,
+ * resized in place with mremap() instead of being copied. Must be at most
+ * half of ALLOCATOR_CHUNK_SIZE. Default for the mmap_threshold setting,
+ * which can never exceed the value compiled in here.
+ */
+#ifndef ALLOCATOR_MMAP_THRESHOLD
+#define ALLOCATOR_MMAP_THRESHOLD (1UL * 1024 * 1024)
+#endif
+
+/**
+ * @brief Upper bound on the number of arenas.
+ *
+ * One arena is created per online CPU, or as many as the arenas setting
+ * asks for, capped at this value. Each arena has its own lock, chunks and
+ * free bins, and every thread is bound to one.
+ */
+#ifndef ALLOCATOR_MAX_ARENAS
+#define ALLOCATOR_MAX_ARENAS 64
+#endif
+
+/**
+ * @brief Milliseconds a free heap page stays resident before it is purged.
+ *
+ * Whole pages inside free blocks that stay unused this long are returned to
+ * the OS with madvise(), and chunks that become entirely free are unmapped.
+ * Recently freed memory is kept so bursts of traffic reuse it without
+ * faulting. Set to 0 to purge only when allocator_trim() is called.
+ * Default for the decay_ms setting.
+ */
+#ifndef ALLOCATOR_DECAY_MS
+#define ALLOCATOR_DECAY_MS 1000
+#endif
+
+/**
+ * @brief Set to 1 to start a background maintenance thread in allocator_init().
+ *
+ * The thread purges pages that have outlived the decay_ms setting, trims
+ * thread cache bins that went unused since its last pass and returns the
+ * caches of exited threads to their arenas, so application threads skip
+ * that work. Default for the background_thread setting.
+ */
+#ifndef ALLOCATOR_BACKGROUND_THREAD
+#define ALLOCATOR_BACKGROUND_THREAD 0
+#endif
+
+/**
+ * @brief Milliseconds the background thread sleeps between passes.
+ */
+#ifndef ALLOCATOR_BACKGROUND_INTERVAL_MS
+#define ALLOCATOR_BACKGROUND_INTERVAL_MS 100
+#endif
+
+/**
+ * @brief Freed heap blocks each arena holds back from coalescing.
+ *
+ * A block freed while the list has room is kept as it is, without merging
+ * it with its neighbours, so a program that frees and reallocates the same
+ * sizes reuses it without splitting and merging boundary tags each time.
+ * The list is coalesced when it fills up, when an allocation finds no fit
+ * in it and in allocator_trim(). Set to 0 to coalesce every free. Default
+ * for the coalesce_defer setting.
+ */
+#ifndef ALLOCATOR_COALESCE_DEFER
+#define ALLOCATOR_COALESCE_DEFER 0
+#endif
+
+/**
+ * @brief Set to 0 to ignore the NUMA topology on Linux.
+ *
+ * When enabled, arenas are spread evenly over the online NUMA nodes, each
+ * thread is bound to an arena on the node it first allocates from, and the
+ * chunks of an arena are placed on its node with mbind().
+ */
+#ifndef ALLOCATOR_NUMA
+#define ALLOCATOR_NUMA 1
+#endif
+
+/**
+ * @brief Whether chunks are backed by 2 MiB huge pages on Linux.
+ *
+ * 0 uses normal pages. 1 asks for transparent huge pages with
+ * madvise(MADV_HUGEPAGE). 2 maps chunks with MAP_HUGETLB from the reserved
+ * huge page pool, falling back to 1 when the pool is empty. When huge pages
+ * are enabled, free memory is purged only in whole 2 MiB pages so resident
+ * huge pages are not split. Chunks should be a multiple of 2 MiB. Default
+ * for the huge_pages setting.
+ */
+#ifndef ALLOCATOR_HUGE_PAGES
+#define ALLOCATOR_HUGE_PAGES 0
+#endif
+
+/**
+ * @brief Size in bytes of the blocks a region takes from the heap.
+ *
+ * Regions created with allocator_arena_create() bump-allocate out of blocks
+ * of this size, and objects larger than a quarter of it get a block of their
+ * own. Should stay well below ALLOCATOR_MMAP_THRESHOLD so that blocks are
+ * recycled through the heap instead of being mapped one by one.
+ */
+#ifndef ALLOCATOR_REGION_BLOCK_SIZE
+#define ALLOCATOR_REGION_BLOCK_SIZE (64UL * 1024)
+#endif
+
+/**
+ * @brief Whether lock and OS call latencies are traced.
+ *
+ * 1 times arena lock waits and holds on the allocation and free paths, and
+ * the chunk mappings made when a heap grows, into per-thread histograms
+ * reported by allocator_get_stats(). Each measurement also fires a USDT
+ * probe when <sys/sdt.h> is available. Costs about three clock reads per
+ * lock; 0 compiles all of it out.
+ */
+#ifndef ALLOCATOR_TRACE
+#define ALLOCATOR_TRACE 0
+#endif
+
+/**
+ * @brief Mean bytes allocated between heap profiler samples.
+ *
+ * 0 turns the profiler off, leaving one subtraction and one branch on the
+ * allocation fast path. 524288 gives a useful profile for a few percent of
+ * overhead. Default for the prof_sample setting.
+ */
+#ifndef ALLOCATOR_PROF_SAMPLE
+#define ALLOCATOR_PROF_SAMPLE 0
+#endif
+
+#endif
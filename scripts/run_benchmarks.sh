@@ -0,0 +1,35 @@
+#!/bin/sh
+# Builds and runs the benchmarks against this allocator, the system malloc
+# and, when installed, jemalloc and tcmalloc, then plots the results.
+# Arguments are passed to every benchmark program, e.g.
+#
+#     scripts/run_benchmarks.sh -t 1,4,16 -w larson,prodcons
+#
+# Author: Ameed Othman
+# Date: 14/10/2026
+set -e
+
+cd "$(dirname "$0")/.."
+RESULTS=benchmarks/results
+mkdir -p "$RESULTS"
+
+make benchmarks
+build/bin/benchmark_allocator "$@"
+build/bin/benchmark_standard_malloc "$@"
+CSV_FILES="$RESULTS/allocator_results.csv $RESULTS/standard_malloc_results.csv"
+
+# Other allocators are measured by preloading them under the baseline program
+for lib in jemalloc tcmalloc; do
+    path=$(ldconfig -p 2>/dev/null | awk -v lib="lib$lib.so" '$1 ~ "^" lib { print $NF; exit }')
+    if [ -n "$path" ]; then
+        LD_PRELOAD="$path" build/bin/benchmark_standard_malloc -l "$lib" \
+            -o "$RESULTS/${lib}_results.csv" "$@"
+        CSV_FILES="$CSV_FILES $RESULTS/${lib}_results.csv"
+    fi
+done
+
+if python3 -c "import matplotlib" 2>/dev/null; then
+    python3 benchmarks/plot_results.py $CSV_FILES
+else
+    echo "matplotlib not found; skipping plots"
+fi
@@ -5,66 +5,231 @@
  * @author Ameed Othman
  * @date 30/11/2024
  */
+#define _GNU_SOURCE // mremap()
 #include "allocator.h"
 #include "allocator_internal.h"
+#include "config.h"
+#include <errno.h>
+#include <execinfo.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 
 // Constants and Macros
 #define ALIGNMENT 16
 #define BLOCK_SIZE sizeof(memory_block_t)
-#define PAGE_SIZE sysconf(_SC_PAGESIZE)
+#define CHUNK_HEADER_SIZE ((sizeof(heap_chunk_t) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+#define FREE_LINKS(block) ((free_links_t*)((block) + 1))
+#define TCACHE_MAX_SIZE (TCACHE_NUM_BINS * ALIGNMENT) // Largest size served by the thread cache
+#define SMALL_BIN_COUNT TCACHE_NUM_BINS       // Exact bins, one per ALIGNMENT step
+#define SMALL_MAX_SIZE (SMALL_BIN_COUNT * ALIGNMENT)
+#define SMALL_MAX_SHIFT 10                    // log2(SMALL_MAX_SIZE)
+#define LARGE_BINS_PER_POW2 4                 // Sub-bins per power of two above SMALL_MAX_SIZE
+#define TCACHE_BIN_CAPACITY 64  // Default for the tcache_max setting
+#define TCACHE_BIN_LIMIT 4096   // Largest tcache_max accepted
+#define DEFER_LIMIT 1024        // Largest coalesce_defer accepted; the list is searched linearly
+#define ARENA_SWITCH_THRESHOLD 4 // Consecutive contended locks before a thread changes arena
+#define CHUNK_BLOCK_SIZE (ALLOCATOR_CHUNK_SIZE - CHUNK_HEADER_SIZE - 2 * BLOCK_SIZE) // Payload of a fresh chunk
+#define CHUNK_OF(ptr) ((heap_chunk_t*)((uintptr_t)(ptr) & ~(ALLOCATOR_CHUNK_SIZE - 1)))
+#define SLAB_SIZE (ALLOCATOR_CHUNK_SIZE / SLABS_PER_CHUNK)
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+// Rounded up so slab 0 starts on the same boundaries as the others; objects
+// of a class that is a multiple of an alignment up to TCACHE_MAX_SIZE are then aligned
+#define SLAB_CHUNK_HEADER_SIZE ((sizeof(slab_chunk_t) + (TCACHE_MAX_SIZE - 1)) & ~(TCACHE_MAX_SIZE - 1))
+#define HUGE_PAYLOAD(chunk) ((char*)(chunk) + (chunk)->offset)
+#define HUGE_USABLE(chunk) ((chunk)->size - (chunk)->offset) // Payload bytes of a huge mapping
+#if ALLOCATOR_TRACE && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, a, b) DTRACE_PROBE2(mtalloc, name, a, b)
+#endif
+#endif
+#ifndef TRACE_PROBE
+#define TRACE_PROBE(name, a, b) ((void)0)
+#endif
+#define PROF_RECHECK_BYTES (1L << 20) // Bytes between looks at the prof_sample setting while it is 0
+#define PROF_SITE_BUCKETS 1024        // Hash buckets for profiler call sites
+#define PROF_SAMPLE_BUCKETS 4096      // Hash buckets for live profiler samples
+// Settings may change while other threads allocate, so they are read atomically
+#define CONFIG(field) __atomic_load_n(&config.field, __ATOMIC_RELAXED)
+// Blocks moved per refill or flush: half a bin
+#define TCACHE_BATCH ((unsigned int)(CONFIG(tcache_max) + 1) / 2)
+// Per-thread counters have a single writer, so a relaxed load and store is enough
+#define STAT_ADD(tc, field, n) __atomic_store_n(&(tc)->stats.field, (tc)->stats.field + (n), __ATOMIC_RELAXED)
+
+_Static_assert((ALLOCATOR_CHUNK_SIZE & (ALLOCATOR_CHUNK_SIZE - 1)) == 0,
+               "ALLOCATOR_CHUNK_SIZE must be a power of two");
+_Static_assert(ALLOCATOR_MMAP_THRESHOLD <= ALLOCATOR_CHUNK_SIZE / 2,
+               "ALLOCATOR_MMAP_THRESHOLD must fit in a chunk");
+_Static_assert(SLAB_CHUNK_HEADER_SIZE + TCACHE_MAX_SIZE <= SLAB_SIZE,
+               "ALLOCATOR_CHUNK_SIZE is too small for the slab table");
 
 // Align size to the nearest multiple of ALIGNMENT
 static size_t align_size(size_t size) {
     return (size + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1);
 }
 
-static memory_block_t* free_list = NULL;
-static pthread_mutex_t allocator_mutex = PTHREAD_MUTEX_INITIALIZER;
+static arena_t arenas[ALLOCATOR_MAX_ARENAS];
+static unsigned int arena_count = 0;       // Arenas in use, set once by arena_setup()
+static unsigned int next_arena = 0;        // Round-robin cursor for binding new threads
+static unsigned int node_count = 1;        // NUMA nodes arenas are spread over, set by arena_setup()
+static size_t page_size = 4096;            // sysconf(_SC_PAGESIZE), read once by arena_setup()
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+static alloc_config_t config = {
+    .arenas = 0,
+    .tcache_max = TCACHE_BIN_CAPACITY,
+    .decay_ms = ALLOCATOR_DECAY_MS,
+    .huge_pages = ALLOCATOR_HUGE_PAGES,
+    .coalesce_defer = ALLOCATOR_COALESCE_DEFER,
+    .background_thread = ALLOCATOR_BACKGROUND_THREAD,
+    .mmap_threshold = ALLOCATOR_MMAP_THRESHOLD,
+    .prof_sample = ALLOCATOR_PROF_SAMPLE,
+    .prof_signal = 0,
+};
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+// Allocations above the mmap_threshold setting, each in its own mapping
+static heap_chunk_t* huge_list = NULL;
+static pthread_mutex_t huge_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Bumped by allocator_destroy() so thread caches drop blocks from unmapped heaps
+static unsigned long heap_generation = 0;
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+// Threads with live caches, plus the folded counters of threads that exited
+static tcache_t* stats_threads = NULL;
+static tcache_stats_t stats_retired;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static os_stats_t os_stats;
+static allocator_pool_t* pool_list = NULL; // Live pools, for flushing cache slots by id
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t pool_next_id = 1;
+static prof_site_t* prof_sites[PROF_SITE_BUCKETS];
+static prof_sample_t* prof_samples[PROF_SAMPLE_BUCKETS];
+static pthread_mutex_t prof_mutex = PTHREAD_MUTEX_INITIALIZER; // Protects both tables
+static allocator_pool_t* prof_site_pool = NULL;   // Backing store for prof_site_t
+static allocator_pool_t* prof_sample_pool = NULL; // Backing store for prof_sample_t
+static volatile sig_atomic_t prof_dump_requested = 0;
+static unsigned int prof_dump_seq = 0;
+
+// Maintenance thread; background_mutex is only held by itself and never nests
+static pthread_t background_tid;
+static pthread_mutex_t background_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t background_cond = PTHREAD_COND_INITIALIZER;
+static int background_running = 0;       // Set while the thread exists; threads then skip inline purges
+static int background_stopping = 0;      // Asks the thread to exit
+static unsigned long background_epoch = 0; // Passes completed, compared against tcache_t::gc_epoch
 
 int allocator_init(void) {
-    // Initialization if required
+    pthread_once(&arena_once, arena_setup);
+    if (CONFIG(background_thread)) {
+        return background_start();
+    }
     return 0;
 }
 
 void allocator_destroy(void) {
-    pthread_mutex_lock(&allocator_mutex);
-    memory_block_t* current = free_list;
-    while (current) {
-        memory_block_t* next = current->next;
-        if (!current->free) {
-            munmap(current, current->size + BLOCK_SIZE);
+    pthread_once(&arena_once, arena_setup);
+    // The thread walks the arenas, so it must be gone before they are torn down
+    background_stop();
+    // The profiler's pools are headed by heap blocks, so they go first
+    pthread_mutex_lock(&prof_mutex);
+    allocator_pool_t* site_pool = prof_site_pool;
+    allocator_pool_t* sample_pool = prof_sample_pool;
+    prof_site_pool = NULL;
+    prof_sample_pool = NULL;
+    memset(prof_sites, 0, sizeof(prof_sites));
+    memset(prof_samples, 0, sizeof(prof_samples));
+    pthread_mutex_unlock(&prof_mutex);
+    allocator_pool_destroy(site_pool);
+    allocator_pool_destroy(sample_pool);
+    // Every other pool header sits in an arena chunk too, and the fork
+    // handlers lock each pool on the list
+    for (;;) {
+        pthread_mutex_lock(&pool_mutex);
+        allocator_pool_t* pool = pool_list;
+        pthread_mutex_unlock(&pool_mutex);
+        if (!pool) {
+            break;
+        }
+        allocator_pool_destroy(pool);
+    }
+    for (unsigned int i = 0; i < arena_count; i++) {
+        arena_t* arena = &arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        heap_chunk_t* chunk = arena->chunks;
+        while (chunk) {
+            heap_chunk_t* next = chunk->next;
+            os_unmap(chunk, chunk->size);
+            chunk = next;
         }
-        current = next;
+        arena->chunks = NULL;
+        memset(arena->slabs_partial, 0, sizeof(arena->slabs_partial));
+        arena->slabs_empty = NULL;
+        memset(arena->bins, 0, sizeof(arena->bins));
+        memset(arena->bin_map, 0, sizeof(arena->bin_map));
+        arena->free_bytes = 0;
+        arena->remote_free = NULL;
+        arena->next_purge_ms = 0;
+        arena->deferred = NULL;
+        arena->deferred_count = 0;
+        pthread_mutex_unlock(&arena->lock);
     }
-    free_list = NULL;
-    pthread_mutex_unlock(&allocator_mutex);
+    heap_generation++;
+
+    pthread_mutex_lock(&huge_mutex);
+    heap_chunk_t* chunk = huge_list;
+    while (chunk) {
+        heap_chunk_t* next = chunk->next;
+        os_unmap(chunk, chunk->size);
+        chunk = next;
+    }
+    huge_list = NULL;
+    pthread_mutex_unlock(&huge_mutex);
 }
 
 void* allocator_malloc(size_t size) {
-    if (size == 0) {
+    if (size == 0 || size > PTRDIFF_MAX) {
         return NULL;
     }
     size = align_size(size);
-    pthread_mutex_lock(&allocator_mutex);
-    memory_block_t* block = find_block(size);
-    if (block) {
-        block->free = 0;
-        if (block->size > size + BLOCK_SIZE + ALIGNMENT) {
-            split_block(block, size);
-        }
-    } else {
-        block = extend_heap(free_list, size);
-        if (!block) {
-            pthread_mutex_unlock(&allocator_mutex);
-            return NULL;
+    tcache_t* tc = tcache_get();
+    // The only cost of the profiler until the countdown runs out
+    tc->prof_countdown -= (int64_t)size;
+    if (__builtin_expect(tc->prof_countdown < 0, 0)) {
+        return prof_malloc(tc, size);
+    }
+    if (size <= TCACHE_MAX_SIZE) {
+        return tcache_alloc(tc, bin_index(size), size);
+    }
+    if (size > CONFIG(mmap_threshold)) {
+        void* ptr = huge_alloc(size, ALIGNMENT);
+        if (ptr) {
+            STAT_ADD(tc, huge_allocs, 1);
+            STAT_ADD(tc, bytes_allocated, HUGE_USABLE(CHUNK_OF(ptr)));
         }
+        return ptr;
+    }
+    arena_t* arena = arena_acquire(tc);
+    memory_block_t* block = heap_alloc_block(arena, size, NULL);
+    arena_unlock(tc, arena);
+    if (!block) {
+        return NULL;
     }
-    pthread_mutex_unlock(&allocator_mutex);
+    STAT_ADD(tc, large_allocs, 1);
+    STAT_ADD(tc, bytes_allocated, block_size(block));
     return (void*)(block + 1);
 }
 
@@ -76,96 +241,869 @@ void* allocator_realloc(void* ptr, size_t size) {
         allocator_free(ptr);
         return NULL;
     }
-    memory_block_t* block = get_block(ptr);
-    if (!valid_block(block)) {
+    if (size > PTRDIFF_MAX) {
         return NULL;
     }
     size = align_size(size);
-    pthread_mutex_lock(&allocator_mutex);
-    if (block->size >= size) {
-        if (block->size > size + BLOCK_SIZE + ALIGNMENT) {
-            split_block(block, size);
+    heap_chunk_t* chunk = CHUNK_OF(ptr);
+    size_t old_size;
+    if (chunk->kind == CHUNK_SLAB) {
+        // Only a size in the same class stays, so the class always matches
+        // the size the caller passes to allocator_free_sized()
+        old_size = ptr_slab(ptr)->obj_size;
+        if (size == old_size) {
+            return ptr;
+        }
+    } else if (chunk->kind == CHUNK_POOL) {
+        old_size = chunk->pool->obj_size;
+        if (size <= old_size) {
+            return ptr;
+        }
+    } else if (chunk->kind == CHUNK_HUGE) {
+        old_size = HUGE_USABLE(chunk);
+        if (size > CONFIG(mmap_threshold)) {
+            void* new_ptr = huge_realloc(chunk, size);
+            if (new_ptr) {
+                tcache_t* tc = tcache_get();
+                if (CHUNK_OF(new_ptr)->sampled) {
+                    prof_resize(ptr, new_ptr, size);
+                }
+                size_t new_size = HUGE_USABLE(CHUNK_OF(new_ptr));
+                if (new_size > old_size) {
+                    STAT_ADD(tc, bytes_allocated, new_size - old_size);
+                } else {
+                    STAT_ADD(tc, bytes_freed, old_size - new_size);
+                }
+                return new_ptr;
+            }
         }
-        pthread_mutex_unlock(&allocator_mutex);
-        return ptr;
     } else {
-        pthread_mutex_unlock(&allocator_mutex);
-        void* new_ptr = allocator_malloc(size);
-        if (!new_ptr) {
+        memory_block_t* block = get_block(ptr);
+        if (!valid_block(block)) {
             return NULL;
         }
-        memcpy(new_ptr, ptr, block->size);
-        allocator_free(ptr);
-        return new_ptr;
+        // Only the caller may resize its block, so its size is stable without the lock
+        old_size = block_size(block);
+        if (old_size >= size) {
+            if (old_size > size + BLOCK_SIZE + ALIGNMENT) {
+                // Shrink in place; the tail goes back to the bins
+                tcache_t* tc = tcache_get();
+                arena_t* arena = chunk->arena;
+                arena_lock(tc, arena);
+                arena_decay(arena);
+                split_block(arena, block, size);
+                arena_unlock(tc, arena);
+                STAT_ADD(tc, bytes_freed, old_size - size);
+            }
+            if (block->size & BLOCK_SAMPLED) {
+                prof_resize(ptr, ptr, size);
+            }
+            return ptr;
+        }
+        if (size <= CONFIG(mmap_threshold)) {
+            tcache_t* tc = tcache_get();
+            arena_t* arena = chunk->arena;
+            arena_lock(tc, arena);
+            int grown = heap_grow_block(arena, block, size);
+            size_t new_size = block_size(block);
+            arena_unlock(tc, arena);
+            if (grown) {
+                STAT_ADD(tc, bytes_allocated, new_size - old_size);
+                if (block->size & BLOCK_SAMPLED) {
+                    prof_resize(ptr, ptr, size);
+                }
+                return ptr;
+            }
+        }
     }
+    void* new_ptr = allocator_malloc(size);
+    if (!new_ptr) {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    allocator_free(ptr);
+    return new_ptr;
 }
 
 void allocator_free(void* ptr) {
     if (ptr == NULL) {
         return;
     }
-    pthread_mutex_lock(&allocator_mutex);
+    heap_chunk_t* chunk = CHUNK_OF(ptr);
+    if (chunk->kind == CHUNK_SLAB) {
+        tcache_put(tcache_get(), ptr, ptr_slab(ptr)->obj_size);
+        return;
+    }
+    if (chunk->kind == CHUNK_POOL) {
+        allocator_pool_free(chunk->pool, ptr);
+        return;
+    }
+    tcache_t* tc = tcache_get();
+    if (chunk->kind == CHUNK_HUGE) {
+        STAT_ADD(tc, huge_frees, 1);
+        STAT_ADD(tc, bytes_freed, HUGE_USABLE(chunk));
+        if (chunk->sampled) {
+            prof_forget(ptr);
+        }
+        huge_free(chunk);
+        return;
+    }
     memory_block_t* block = get_block(ptr);
     if (!valid_block(block)) {
-        pthread_mutex_unlock(&allocator_mutex);
         return;
     }
-    block->free = 1;
-    merge_blocks(block);
-    pthread_mutex_unlock(&allocator_mutex);
+    if (block->size & BLOCK_SAMPLED) {
+        prof_forget(ptr);
+        block->size &= ~BLOCK_SAMPLED;
+    }
+    STAT_ADD(tc, large_frees, 1);
+    STAT_ADD(tc, bytes_freed, block_size(block));
+    arena_t* arena = chunk->arena;
+    if (arena != tc->arena) {
+        // Foreign block: hand it to its owner without taking the owner's lock
+        arena_remote_push(arena, ptr, ptr);
+        return;
+    }
+    arena_lock(tc, arena);
+    arena_decay(arena);
+    heap_free_block(arena, block);
+    arena_unlock(tc, arena);
+}
+
+int allocator_config_set(const char* name, size_t value) {
+    if (name == NULL) {
+        return -1;
+    }
+    pthread_once(&config_once, config_load_env);
+    int result = config_apply(name, strlen(name), value);
+    if (result == 0 && strcmp(name, "prof_sample") == 0) {
+        // Takes effect at once here; other threads look again within PROF_RECHECK_BYTES
+        tcache.prof_countdown = 0;
+    }
+    return result;
+}
+
+int allocator_config_get(const char* name, size_t* value) {
+    if (name == NULL || value == NULL) {
+        return -1;
+    }
+    pthread_once(&config_once, config_load_env);
+    if (strcmp(name, "arenas") == 0) {
+        // Once the arenas exist, report how many there really are
+        unsigned int count = __atomic_load_n(&arena_count, __ATOMIC_ACQUIRE);
+        *value = count ? count : config.arenas;
+    } else if (strcmp(name, "tcache_max") == 0) {
+        *value = CONFIG(tcache_max);
+    } else if (strcmp(name, "decay_ms") == 0) {
+        *value = CONFIG(decay_ms);
+    } else if (strcmp(name, "huge_pages") == 0) {
+        *value = CONFIG(huge_pages);
+    } else if (strcmp(name, "coalesce_defer") == 0) {
+        *value = CONFIG(coalesce_defer);
+    } else if (strcmp(name, "background_thread") == 0) {
+        *value = CONFIG(background_thread);
+    } else if (strcmp(name, "mmap_threshold") == 0) {
+        *value = CONFIG(mmap_threshold);
+    } else if (strcmp(name, "prof_sample") == 0) {
+        *value = CONFIG(prof_sample);
+    } else if (strcmp(name, "prof_signal") == 0) {
+        *value = CONFIG(prof_signal);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+void* allocator_malloc_onnode(size_t size, int node) {
+    pthread_once(&arena_once, arena_setup);
+    if (size == 0 || size > PTRDIFF_MAX || node < 0 || (unsigned int)node >= node_count) {
+        return NULL;
+    }
+    size = align_size(size);
+    tcache_t* tc = tcache_get();
+    if (size > CONFIG(mmap_threshold)) {
+        void* ptr = huge_alloc(size, ALIGNMENT);
+        if (ptr) {
+            heap_chunk_t* chunk = CHUNK_OF(ptr);
+            numa_bind(chunk, chunk->size, node);
+            STAT_ADD(tc, huge_allocs, 1);
+            STAT_ADD(tc, bytes_allocated, HUGE_USABLE(chunk));
+        }
+        return ptr;
+    }
+    // The thread cache mixes arenas, so go straight to an arena on the node
+    arena_t* arena = tc->arena->node == node ? tc->arena : &arenas[node];
+    arena_lock(tc, arena);
+    arena_decay(arena);
+    arena_drain_remote(arena);
+    void* ptr;
+    if (size <= TCACHE_MAX_SIZE) {
+        ptr = slab_alloc(arena, size);
+        if (ptr) {
+            STAT_ADD(tc, small_allocs[bin_index(size)], 1);
+            STAT_ADD(tc, bytes_allocated, size);
+        }
+    } else {
+        memory_block_t* block = heap_alloc_block(arena, size, NULL);
+        ptr = block ? (void*)(block + 1) : NULL;
+        if (block) {
+            STAT_ADD(tc, large_allocs, 1);
+            STAT_ADD(tc, bytes_allocated, block_size(block));
+        }
+    }
+    arena_unlock(tc, arena);
+    return ptr;
+}
+
+void* allocator_malloc_class(unsigned int size_class) {
+    if (size_class >= TCACHE_NUM_BINS) {
+        return NULL;
+    }
+    size_t size = ((size_t)size_class + 1) * ALIGNMENT;
+    tcache_t* tc = tcache_get();
+    tc->prof_countdown -= (int64_t)size;
+    if (__builtin_expect(tc->prof_countdown < 0, 0)) {
+        return prof_malloc(tc, size);
+    }
+    return tcache_alloc(tc, size_class, size);
+}
+
+void allocator_free_class(void* ptr, unsigned int size_class) {
+    if (ptr == NULL) {
+        return;
+    }
+    // Sampled objects come from the heap even when they are small
+    if (size_class < TCACHE_NUM_BINS && CHUNK_OF(ptr)->kind == CHUNK_SLAB) {
+        tcache_put(tcache_get(), ptr, ((size_t)size_class + 1) * ALIGNMENT);
+        return;
+    }
+    allocator_free(ptr);
+}
+
+void allocator_free_sized(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    size = align_size(size);
+    // Slab classes are exact, so the class follows from the size without
+    // reading the slab table
+    if (size <= TCACHE_MAX_SIZE && CHUNK_OF(ptr)->kind == CHUNK_SLAB) {
+        tcache_put(tcache_get(), ptr, size);
+        return;
+    }
+    allocator_free(ptr);
+}
+
+size_t allocator_malloc_batch(size_t size, size_t n, void** out) {
+    if (size == 0 || out == NULL) {
+        return 0;
+    }
+    size = align_size(size);
+    tcache_t* tc = tcache_get();
+    size_t done = 0;
+    if (size <= TCACHE_MAX_SIZE) {
+        // Drain the cached objects, then carve the rest from slabs under one lock
+        size_t index = bin_index(size);
+        tcache_bin_t* bin = &tc->bins[index];
+        while (done < n && bin->head) {
+            out[done++] = bin->head;
+            bin->head = *(void**)bin->head;
+            bin->count--;
+        }
+        STAT_ADD(tc, cache_hits, done);
+        if (done < n) {
+            size_t cached = done;
+            arena_t* arena = arena_acquire(tc);
+            while (done < n && (out[done] = slab_alloc(arena, size)) != NULL) {
+                done++;
+            }
+            arena_unlock(tc, arena);
+            STAT_ADD(tc, cache_misses, done - cached);
+        }
+        STAT_ADD(tc, small_allocs[index], done);
+        STAT_ADD(tc, bytes_allocated, done * size);
+        return done;
+    }
+    if (size > CONFIG(mmap_threshold)) {
+        // Each huge allocation is its own mapping, so there is nothing to share
+        while (done < n && (out[done] = allocator_malloc(size)) != NULL) {
+            done++;
+        }
+        return done;
+    }
+    arena_t* arena = arena_acquire(tc);
+    size_t bytes = 0;
+    while (done < n) {
+        memory_block_t* block = heap_alloc_block(arena, size, NULL);
+        if (!block) {
+            break;
+        }
+        bytes += block_size(block);
+        out[done++] = block + 1;
+    }
+    arena_unlock(tc, arena);
+    STAT_ADD(tc, large_allocs, done);
+    STAT_ADD(tc, bytes_allocated, bytes);
+    return done;
+}
+
+void allocator_free_batch(void** ptrs, size_t n) {
+    if (ptrs == NULL) {
+        return;
+    }
+    tcache_t* tc = tcache_get();
+    arena_t* locked = NULL;
+    size_t i = 0;
+    while (i < n) {
+        void* ptr = ptrs[i++];
+        if (ptr == NULL) {
+            continue;
+        }
+        heap_chunk_t* chunk = CHUNK_OF(ptr);
+        if (chunk->kind == CHUNK_HEAP && valid_block(get_block(ptr))) {
+            memory_block_t* block = get_block(ptr);
+            if (block->size & BLOCK_SAMPLED) {
+                prof_forget(ptr);
+                block->size &= ~BLOCK_SAMPLED;
+            }
+            STAT_ADD(tc, large_frees, 1);
+            STAT_ADD(tc, bytes_freed, block_size(block));
+            arena_t* owner = chunk->arena;
+            if (owner == tc->arena) {
+                // Keep the lock across a run of blocks from this thread's arena
+                if (!locked) {
+                    arena_lock(tc, owner);
+                    arena_decay(owner);
+                    locked = owner;
+                }
+                heap_free_block(owner, block);
+                continue;
+            }
+            // Hand a run of blocks with the same foreign owner over in one push
+            void* tail = ptr;
+            while (i < n && ptrs[i] && CHUNK_OF(ptrs[i])->kind == CHUNK_HEAP &&
+                   CHUNK_OF(ptrs[i])->arena == owner && valid_block(get_block(ptrs[i]))) {
+                block = get_block(ptrs[i]);
+                if (block->size & BLOCK_SAMPLED) {
+                    prof_forget(ptrs[i]);
+                    block->size &= ~BLOCK_SAMPLED;
+                }
+                STAT_ADD(tc, large_frees, 1);
+                STAT_ADD(tc, bytes_freed, block_size(block));
+                *(void**)tail = ptrs[i];
+                tail = ptrs[i++];
+            }
+            arena_remote_push(owner, ptr, tail);
+            continue;
+        }
+        // Slab objects may flush the thread cache, which takes the arena lock itself
+        if (locked) {
+            arena_unlock(tc, locked);
+            locked = NULL;
+        }
+        allocator_free(ptr);
+    }
+    if (locked) {
+        arena_unlock(tc, locked);
+    }
 }
 
 void* allocator_calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > PTRDIFF_MAX / size) {
+        return NULL;
+    }
     size_t total_size = nmemb * size;
-    void* ptr = allocator_malloc(total_size);
-    if (ptr) {
-        memset(ptr, 0, total_size);
+    size_t aligned = align_size(total_size);
+    if (total_size == 0 || aligned <= TCACHE_MAX_SIZE) {
+        void* ptr = allocator_malloc(total_size);
+        if (ptr) {
+            memset(ptr, 0, total_size);
+        }
+        return ptr;
+    }
+    if (aligned > CONFIG(mmap_threshold)) {
+        // A huge allocation is always a fresh, zero-filled mapping, but the
+        // threshold may have been raised meanwhile
+        void* ptr = allocator_malloc(total_size);
+        if (ptr && CHUNK_OF(ptr)->kind != CHUNK_HUGE) {
+            memset(ptr, 0, total_size);
+        }
+        return ptr;
+    }
+    tcache_t* tc = tcache_get();
+    tc->prof_countdown -= (int64_t)aligned;
+    if (__builtin_expect(tc->prof_countdown < 0, 0)) {
+        void* ptr = prof_malloc(tc, aligned);
+        if (ptr) {
+            memset(ptr, 0, total_size);
+        }
+        return ptr;
+    }
+    arena_t* arena = arena_acquire(tc);
+    int zeroed;
+    memory_block_t* block = heap_alloc_block(arena, aligned, &zeroed);
+    arena_unlock(tc, arena);
+    if (!block) {
+        return NULL;
+    }
+    STAT_ADD(tc, large_allocs, 1);
+    STAT_ADD(tc, bytes_allocated, block_size(block));
+    // Memory that was never written only needs its bin links cleared
+    memset(block + 1, 0, zeroed ? sizeof(free_links_t) : total_size);
+    return (void*)(block + 1);
+}
+
+void* allocator_aligned_alloc(size_t alignment, size_t size) {
+    if (size == 0 || size > PTRDIFF_MAX || alignment == 0 || (alignment & (alignment - 1)) ||
+        alignment >= ALLOCATOR_CHUNK_SIZE) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return allocator_malloc(size);
+    }
+    // Slab objects of a class that is a multiple of the alignment are aligned.
+    // The slab is used directly: a sampled block would only be 16-byte aligned
+    size_t rounded = (size + alignment - 1) & ~(alignment - 1);
+    tcache_t* tc = tcache_get();
+    if (rounded <= TCACHE_MAX_SIZE) {
+        return tcache_alloc(tc, bin_index(rounded), rounded);
+    }
+    size = align_size(size);
+    size_t threshold = CONFIG(mmap_threshold);
+    if (size > threshold || alignment + 2 * ALIGNMENT > threshold - size) {
+        void* ptr = huge_alloc(size, alignment);
+        if (ptr) {
+            STAT_ADD(tc, huge_allocs, 1);
+            STAT_ADD(tc, bytes_allocated, HUGE_USABLE(CHUNK_OF(ptr)));
+        }
+        return ptr;
+    }
+    arena_t* arena = arena_acquire(tc);
+    memory_block_t* block = heap_alloc_aligned(arena, alignment, size);
+    arena_unlock(tc, arena);
+    if (!block) {
+        return NULL;
+    }
+    STAT_ADD(tc, large_allocs, 1);
+    STAT_ADD(tc, bytes_allocated, block_size(block));
+    return (void*)(block + 1);
+}
+
+int allocator_posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (memptr == NULL || alignment < sizeof(void*) || (alignment & (alignment - 1))) {
+        return EINVAL;
+    }
+    void* ptr = allocator_aligned_alloc(alignment, size);
+    if (!ptr && size != 0) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+allocator_pool_t* allocator_pool_create(size_t obj_size, size_t align) {
+    if (align == 0) {
+        align = ALIGNMENT;
+    }
+    if (obj_size == 0 || obj_size > ALLOCATOR_MMAP_THRESHOLD || (align & (align - 1)) ||
+        align > ALLOCATOR_CHUNK_SIZE / 2) {
+        return NULL;
+    }
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
     }
+    size_t stride = (obj_size + align - 1) & ~(align - 1);
+    if (((CHUNK_HEADER_SIZE + align - 1) & ~(align - 1)) + stride > ALLOCATOR_CHUNK_SIZE) {
+        return NULL;
+    }
+    // Cache-line aligned so that remote pushes do not share a line with the pool lock
+    allocator_pool_t* pool = allocator_aligned_alloc(64, sizeof(allocator_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    memset(pool, 0, sizeof(allocator_pool_t));
+    pool->id = __atomic_fetch_add(&pool_next_id, 1, __ATOMIC_RELAXED);
+    pool->obj_size = stride;
+    pool->align = align;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_lock(&pool_mutex);
+    pool->next = pool_list;
+    if (pool_list) {
+        pool_list->prev = pool;
+    }
+    pool_list = pool;
+    pthread_mutex_unlock(&pool_mutex);
+    return pool;
+}
+
+void* allocator_pool_alloc(allocator_pool_t* pool) {
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool_cache_t* pc = pool_cache(tcache_get(), pool);
+    if (!pc->head && pool_refill(pool, pc) == 0) {
+        return NULL;
+    }
+    void* ptr = pc->head;
+    pc->head = *(void**)ptr;
+    pc->count--;
     return ptr;
 }
 
-static memory_block_t* find_block(size_t size) {
-    memory_block_t* current = free_list;
-    while (current) {
-        if (current->free && current->size >= size) {
-            return current;
+void allocator_pool_free(allocator_pool_t* pool, void* ptr) {
+    if (pool == NULL || ptr == NULL) {
+        return;
+    }
+    pool_cache_t* pc = pool_cache(tcache_get(), pool);
+    if (pc->count >= CONFIG(tcache_max)) {
+        // Keep the cache-hot half, hand the older half to other threads in one push
+        unsigned int keep = pc->count - TCACHE_BATCH;
+        void** link = &pc->head;
+        for (unsigned int i = 0; i < keep; i++) {
+            link = (void**)*link;
+        }
+        void* run = *link;
+        void* tail = run;
+        while (*(void**)tail) {
+            tail = *(void**)tail;
+        }
+        *link = NULL;
+        pc->count = keep;
+        pool_push_shared(pool, run, tail);
+    }
+    *(void**)ptr = pc->head;
+    pc->head = ptr;
+    pc->count++;
+}
+
+void allocator_pool_destroy(allocator_pool_t* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool_mutex);
+    if (pool->prev) {
+        pool->prev->next = pool->next;
+    } else {
+        pool_list = pool->next;
+    }
+    if (pool->next) {
+        pool->next->prev = pool->prev;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    // Other threads drop their slots for this pool the next time they reuse them
+    pool_cache_t* pc = &tcache_get()->pools[pool->id % POOL_CACHE_SLOTS];
+    if (pc->pool_id == pool->id) {
+        memset(pc, 0, sizeof(pool_cache_t));
+    }
+    heap_chunk_t* chunk = pool->chunks;
+    while (chunk) {
+        heap_chunk_t* next = chunk->next;
+        os_unmap(chunk, chunk->size);
+        chunk = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    allocator_free(pool);
+}
+
+int allocator_prof_dump(const char* path) {
+    if (path == NULL) {
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    // Nothing the dump allocates is sampled, so it cannot wait on its own records
+    tcache_t* tc = tcache_get();
+    int busy = tc->prof_busy;
+    tc->prof_busy = 1;
+    int result = prof_write(fd);
+    tc->prof_busy = busy;
+    if (close(fd) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+size_t allocator_trim(void) {
+    tcache_t* tc = tcache_get();
+    for (size_t i = 0; i < TCACHE_NUM_BINS; i++) {
+        tcache_flush(tc, i, tc->bins[i].count);
+    }
+    size_t released = 0;
+    for (unsigned int i = 0; i < arena_count; i++) {
+        arena_t* arena = &arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        arena_drain_remote(arena);
+        heap_defer_flush(arena);
+        released += arena_purge(arena, UINT64_MAX);
+        pthread_mutex_unlock(&arena->lock);
+    }
+    return released;
+}
+
+int allocator_get_stats(allocator_stats_t* stats) {
+    if (!stats) {
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&stats_mutex);
+    stats_merge(stats, &stats_retired);
+    for (tcache_t* tc = stats_threads; tc; tc = tc->stats_next) {
+        stats_merge(stats, &tc->stats);
+    }
+    pthread_mutex_unlock(&stats_mutex);
+
+    pthread_once(&arena_once, arena_setup);
+    for (unsigned int i = 0; i < arena_count; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+        stats->free_bytes += arenas[i].free_bytes;
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+    stats->mapped_bytes = __atomic_load_n(&os_stats.mapped_bytes, __ATOMIC_RELAXED);
+    stats->purged_bytes = __atomic_load_n(&os_stats.purged_bytes, __ATOMIC_RELAXED);
+    stats->mmap_calls = __atomic_load_n(&os_stats.mmap_calls, __ATOMIC_RELAXED);
+    stats->munmap_calls = __atomic_load_n(&os_stats.munmap_calls, __ATOMIC_RELAXED);
+    stats->mremap_calls = __atomic_load_n(&os_stats.mremap_calls, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int allocator_heap_walk(allocator_heap_walk_fn callback, void* ctx) {
+    if (callback == NULL) {
+        return -1;
+    }
+    pthread_once(&arena_once, arena_setup);
+    // One arena at a time, so threads bound to the others keep allocating
+    for (unsigned int i = 0; i < arena_count; i++) {
+        arena_t* arena = &arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        arena_drain_remote(arena);
+        int result = heap_walk_arena(arena, callback, ctx);
+        pthread_mutex_unlock(&arena->lock);
+        if (result) {
+            return result;
+        }
+    }
+    int result = 0;
+    pthread_mutex_lock(&huge_mutex);
+    for (heap_chunk_t* chunk = huge_list; chunk && !result; chunk = chunk->next) {
+        allocator_heap_block_t block;
+        memset(&block, 0, sizeof(block));
+        block.addr = HUGE_PAYLOAD(chunk);
+        block.size = HUGE_USABLE(chunk);
+        block.kind = ALLOCATOR_WALK_HUGE;
+        block.mapping = chunk;
+        block.mapping_size = chunk->size;
+        result = callback(&block, ctx);
+    }
+    pthread_mutex_unlock(&huge_mutex);
+    return result;
+}
+
+int allocator_heap_summary(allocator_heap_summary_t* summary) {
+    if (summary == NULL) {
+        return -1;
+    }
+    memset(summary, 0, sizeof(*summary));
+    heap_summary_ctx_t ctx = {.summary = summary, .mapping = NULL};
+    allocator_heap_walk(heap_summary_add, &ctx);
+    if (summary->free_bytes) {
+        summary->fragmentation = 1.0 - (double)summary->largest_free / (double)summary->free_bytes;
+    }
+    return 0;
+}
+
+int allocator_heap_report(int fd) {
+    allocator_heap_summary_t summary;
+    allocator_heap_summary(&summary);
+    text_out_t out = {.fd = fd, .failed = 0, .used = 0};
+    text_printf(&out, "heap report: %zu mappings, %zu bytes mapped, %zu bytes used\n",
+                summary.mappings, summary.mapped_bytes, summary.used_bytes);
+    text_printf(&out, "free: %zu bytes in %zu blocks, largest %zu, fragmentation %.3f\n",
+                summary.free_bytes, summary.free_blocks, summary.largest_free, summary.fragmentation);
+    for (size_t i = 0; i < ALLOCATOR_FREE_CLASSES; i++) {
+        if (summary.free_histogram[i]) {
+            text_printf(&out, "  free blocks of %zu to %zu bytes: %" PRIu64 "\n", (size_t)1 << i,
+                        ((size_t)2 << i) - 1, summary.free_histogram[i]);
+        }
+    }
+    text_printf(&out, "mappings:\n");
+    heap_report_ctx_t report;
+    memset(&report, 0, sizeof(report));
+    report.out = &out;
+    allocator_heap_walk(heap_report_add, &report);
+    heap_report_mapping(&report);
+    text_flush(&out);
+    return out.failed ? -1 : 0;
+}
+
+uint64_t allocator_latency_percentile(const allocator_latency_t* latency, double percentile) {
+    if (latency == NULL) {
+        return 0;
+    }
+    uint64_t total = 0;
+    for (size_t i = 0; i < ALLOCATOR_LATENCY_BUCKETS; i++) {
+        total += latency->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // The rank of the percentile, counted from 1
+    double wanted = percentile / 100.0 * (double)total;
+    uint64_t rank = wanted < 1.0 ? 1 : (uint64_t)wanted;
+    if ((double)rank < wanted) {
+        rank++;
+    }
+    if (rank > total) {
+        rank = total;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < ALLOCATOR_LATENCY_BUCKETS; i++) {
+        seen += latency->buckets[i];
+        if (seen >= rank) {
+            return latency_bucket_limit(i);
+        }
+    }
+    return latency_bucket_limit(ALLOCATOR_LATENCY_BUCKETS - 1);
+}
+
+size_t allocator_usable_size(void* ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    heap_chunk_t* chunk = CHUNK_OF(ptr);
+    if (chunk->kind == CHUNK_SLAB) {
+        return ptr_slab(ptr)->obj_size;
+    }
+    if (chunk->kind == CHUNK_POOL) {
+        return chunk->pool->obj_size;
+    }
+    if (chunk->kind == CHUNK_HUGE) {
+        return chunk->size - (size_t)((char*)ptr - (char*)chunk);
+    }
+    return block_size(get_block(ptr));
+}
+
+void allocator_prefork(void) {
+    // Same order as everywhere else: arenas, then the global locks
+    pthread_once(&arena_once, arena_setup);
+    for (unsigned int i = 0; i < arena_count; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+    }
+    pthread_mutex_lock(&huge_mutex);
+    pthread_mutex_lock(&stats_mutex);
+    pthread_mutex_lock(&prof_mutex);
+    pthread_mutex_lock(&pool_mutex);
+    for (allocator_pool_t* pool = pool_list; pool; pool = pool->next) {
+        pthread_mutex_lock(&pool->lock);
+    }
+}
+
+void allocator_postfork_parent(void) {
+    for (allocator_pool_t* pool = pool_list; pool; pool = pool->next) {
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    pthread_mutex_unlock(&prof_mutex);
+    pthread_mutex_unlock(&stats_mutex);
+    pthread_mutex_unlock(&huge_mutex);
+    for (unsigned int i = arena_count; i-- > 0;) {
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+}
+
+void allocator_postfork_child(void) {
+    // Only the forking thread survives, so the locks it holds are reset rather than unlocked
+    pthread_mutex_init(&background_mutex, NULL);
+    pthread_cond_init(&background_cond, NULL);
+    background_running = 0;
+    background_stopping = 0;
+    for (allocator_pool_t* pool = pool_list; pool; pool = pool->next) {
+        pthread_mutex_init(&pool->lock, NULL);
+    }
+    pthread_mutex_init(&pool_mutex, NULL);
+    pthread_mutex_init(&prof_mutex, NULL);
+    pthread_mutex_init(&stats_mutex, NULL);
+    pthread_mutex_init(&huge_mutex, NULL);
+    for (unsigned int i = 0; i < arena_count; i++) {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    }
+}
+
+static memory_block_t* find_block(arena_t* arena, size_t size) {
+    size_t index = bin_index(size);
+    if (index < SMALL_BIN_COUNT) {
+        // Exact class: any block in the bin fits
+        if (arena->bins[index]) {
+            return arena->bins[index];
+        }
+    } else {
+        // Large bins span a size range, so only this bin needs a first-fit scan
+        memory_block_t* current = arena->bins[index];
+        while (current) {
+            if (block_size(current) >= size) {
+                return current;
+            }
+            current = FREE_LINKS(current)->next_free;
+        }
+    }
+    // Every block in a higher non-empty bin is large enough
+    index++;
+    for (size_t word = index / 64; word < BIN_MAP_WORDS; word++) {
+        uint64_t bits = arena->bin_map[word];
+        if (word == index / 64) {
+            bits &= ~0ULL << (index % 64);
+        }
+        if (bits) {
+            return arena->bins[word * 64 + (size_t)__builtin_ctzll(bits)];
         }
-        current = current->next;
     }
     return NULL;
 }
 
-static memory_block_t* extend_heap(memory_block_t* last, size_t size) {
-    size_t total_size = size + BLOCK_SIZE;
-    total_size = (total_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1); // Align to page size
-    memory_block_t* block = mmap(NULL, total_size, PROT_READ | PROT_WRITE,
-                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (block == MAP_FAILED) {
+static memory_block_t* extend_heap(arena_t* arena, size_t size) {
+    // Map a whole chunk; the caller splits off the part it needs
+    size_t total_size = ALLOCATOR_CHUNK_SIZE;
+    if (size > CHUNK_BLOCK_SIZE) {
         return NULL;
     }
-    block->size = total_size - BLOCK_SIZE;
-    block->free = 0;
-    block->next = NULL;
-    block->prev = last;
-    if (last) {
-        last->next = block;
-    } else {
-        free_list = block;
+    uint64_t start = trace_now_ns();
+    heap_chunk_t* chunk = chunk_map(total_size);
+    if (!chunk) {
+        return NULL;
     }
+    numa_bind(chunk, total_size, arena->node);
+#if ALLOCATOR_TRACE
+    uint64_t elapsed = trace_now_ns() - start;
+    trace_record(&tcache_get()->stats.os_map, elapsed);
+    TRACE_PROBE(os_map, total_size, elapsed);
+#else
+    (void)start;
+#endif
+    chunk->size = total_size;
+    chunk->arena = arena;
+    chunk->kind = CHUNK_HEAP;
+    chunk_link(&arena->chunks, chunk);
+
+    // A zero prev_size marks the first block and the in-use fence the last,
+    // so coalescing never leaves the chunk
+    memory_block_t* block = (memory_block_t*)((char*)chunk + CHUNK_HEADER_SIZE);
+    block->prev_size = 0;
+    block->size = CHUNK_BLOCK_SIZE | BLOCK_ZERO; // Fresh pages from mmap()
+    memory_block_t* fence = next_block(block);
+    fence->prev_size = CHUNK_BLOCK_SIZE;
+    fence->size = 0;
     return block;
 }
 
-static void split_block(memory_block_t* block, size_t size) {
-    memory_block_t* new_block = (memory_block_t*)((char*)block + BLOCK_SIZE + size);
-    new_block->size = block->size - size - BLOCK_SIZE;
-    new_block->free = 1;
-    new_block->next = block->next;
-    new_block->prev = block;
-    if (new_block->next) {
-        new_block->next->prev = new_block;
-    }
-    block->size = size;
-    block->next = new_block;
+static void split_block(arena_t* arena, memory_block_t* block, size_t size) {
+    memory_block_t* new_block = (memory_block_t*)((char*)(block + 1) + size);
+    new_block->prev_size = size;
+    new_block->size = (block_size(block) - size - BLOCK_SIZE) | BLOCK_FREE | (block->size & BLOCK_ZERO);
+    next_block(new_block)->prev_size = block_size(new_block);
+    block->size = size | (block->size & BLOCK_FLAGS);
+    merge_blocks(arena, new_block);
 }
 
 static memory_block_t* get_block(void* ptr) {
@@ -173,25 +1111,1800 @@ static memory_block_t* get_block(void* ptr) {
 }
 
 static int valid_block(memory_block_t* block) {
-    return block && block->free == 0;
+    return block && !(block->size & (BLOCK_FREE | BLOCK_DEFERRED));
 }
 
-static void merge_blocks(memory_block_t* block) {
-    // Merge with next block if possible
-    if (block->next && block->next->free) {
-        block->size += BLOCK_SIZE + block->next->size;
-        block->next = block->next->next;
-        if (block->next) {
-            block->next->prev = block;
-        }
+static size_t block_size(memory_block_t* block) {
+    return block->size & ~BLOCK_FLAGS;
+}
+
+static memory_block_t* next_block(memory_block_t* block) {
+    return (memory_block_t*)((char*)(block + 1) + block_size(block));
+}
+
+static memory_block_t* prev_block(memory_block_t* block) {
+    return (memory_block_t*)((char*)block - block->prev_size) - 1;
+}
+
+static void merge_zero(memory_block_t* block, memory_block_t* absorbed) {
+    if ((block->size & BLOCK_ZERO) && (absorbed->size & BLOCK_ZERO)) {
+        // The absorbed header and links are now payload and must read as zero
+        memset(absorbed, 0, BLOCK_SIZE + sizeof(free_links_t));
+    } else {
+        block->size &= ~BLOCK_ZERO;
     }
-    // Merge with previous block if possible
-    if (block->prev && block->prev->free) {
-        block->prev->size += BLOCK_SIZE + block->size;
-        block->prev->next = block->next;
-        if (block->next) {
-            block->next->prev = block->prev;
+}
+
+static void merge_blocks(arena_t* arena, memory_block_t* block) {
+    // Merge with next block if possible; the chunk's fence is never free
+    memory_block_t* next = next_block(block);
+    if (next->size & BLOCK_FREE) {
+        bin_remove(arena, next);
+        block->size += BLOCK_SIZE + block_size(next);
+        merge_zero(block, next);
+    }
+    // Merge with previous block if possible; the first block has no previous
+    if (block->prev_size) {
+        memory_block_t* prev = prev_block(block);
+        if (prev->size & BLOCK_FREE) {
+            bin_remove(arena, prev);
+            prev->size += BLOCK_SIZE + block_size(block);
+            merge_zero(prev, block);
+            block = prev;
         }
-        block = block->prev;
     }
-}
\ No newline at end of file
+    next_block(block)->prev_size = block_size(block);
+    bin_insert(arena, block);
+}
+
+static size_t bin_index(size_t size) {
+    if (size <= SMALL_MAX_SIZE) {
+        return (size / ALIGNMENT) - 1;
+    }
+    // LARGE_BINS_PER_POW2 sub-bins per power of two, with the top bin catching the rest
+    size_t shift = (size_t)(63 - __builtin_clzll(size));
+    size_t sub = (size >> (shift - 2)) & (LARGE_BINS_PER_POW2 - 1);
+    size_t index = SMALL_BIN_COUNT + (shift - SMALL_MAX_SHIFT) * LARGE_BINS_PER_POW2 + sub;
+    return index < NUM_BINS ? index : NUM_BINS - 1;
+}
+
+static void bin_insert(arena_t* arena, memory_block_t* block) {
+    size_t index = bin_index(block_size(block));
+    free_links_t* links = FREE_LINKS(block);
+    links->prev_free = NULL;
+    links->next_free = arena->bins[index];
+    if (arena->bins[index]) {
+        FREE_LINKS(arena->bins[index])->prev_free = block;
+    }
+    arena->bins[index] = block;
+    arena->bin_map[index / 64] |= 1ULL << (index % 64);
+    arena->free_bytes += block_size(block);
+    if (index >= SMALL_BIN_COUNT) {
+        links->freed_at = arena->clock_ms;
+        links->purged = 0;
+    }
+}
+
+static void bin_remove(arena_t* arena, memory_block_t* block) {
+    size_t index = bin_index(block_size(block));
+    free_links_t* links = FREE_LINKS(block);
+    arena->free_bytes -= block_size(block);
+    if (links->prev_free) {
+        FREE_LINKS(links->prev_free)->next_free = links->next_free;
+    } else {
+        arena->bins[index] = links->next_free;
+        if (!arena->bins[index]) {
+            arena->bin_map[index / 64] &= ~(1ULL << (index % 64));
+        }
+    }
+    if (links->next_free) {
+        FREE_LINKS(links->next_free)->prev_free = links->prev_free;
+    }
+}
+
+static memory_block_t* heap_alloc_block(arena_t* arena, size_t size, int* zeroed) {
+    memory_block_t* block = NULL;
+    if (arena->deferred) {
+        // A miss coalesces the whole batch before the bins are searched
+        block = heap_defer_take(arena, size);
+        if (!block) {
+            heap_defer_flush(arena);
+        }
+    }
+    if (!block) {
+        block = find_block(arena, size);
+        if (block) {
+            bin_remove(arena, block);
+            block->size &= ~BLOCK_FREE;
+        } else {
+            block = extend_heap(arena, size);
+            if (!block) {
+                return NULL;
+            }
+        }
+    }
+    // Split while the flag is still set so a zero tail stays known-zero
+    if (block_size(block) > size + BLOCK_SIZE + ALIGNMENT) {
+        split_block(arena, block, size);
+    }
+    if (zeroed) {
+        *zeroed = (block->size & BLOCK_ZERO) != 0;
+    }
+    block->size &= ~BLOCK_ZERO;
+    return block;
+}
+
+static memory_block_t* heap_alloc_aligned(arena_t* arena, size_t alignment, size_t size) {
+    // Enough for the payload at any offset, leaving a viable free block in front
+    memory_block_t* block = heap_alloc_block(arena, size + alignment + 2 * ALIGNMENT, NULL);
+    if (!block) {
+        return NULL;
+    }
+    uintptr_t payload = (uintptr_t)(block + 1);
+    uintptr_t aligned = (payload + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned != payload && aligned - payload < BLOCK_SIZE + 2 * ALIGNMENT) {
+        aligned += alignment; // Too close to hold a free block of its own
+    }
+    size_t gap = aligned - payload;
+    if (gap) {
+        // Carve the padding off as a free block in front of the aligned one
+        memory_block_t* aligned_block = (memory_block_t*)aligned - 1;
+        aligned_block->prev_size = gap - BLOCK_SIZE;
+        aligned_block->size = block_size(block) - gap;
+        next_block(aligned_block)->prev_size = block_size(aligned_block);
+        block->size = gap - BLOCK_SIZE;
+        heap_free_block(arena, block);
+        block = aligned_block;
+    }
+    if (block_size(block) > size + BLOCK_SIZE + ALIGNMENT) {
+        split_block(arena, block, size);
+    }
+    return block;
+}
+
+static void heap_free_block(arena_t* arena, memory_block_t* block) {
+    size_t limit = CONFIG(coalesce_defer);
+    if (limit) {
+        if (arena->deferred_count >= limit) {
+            heap_defer_flush(arena);
+        }
+        block->size |= BLOCK_DEFERRED;
+        *(memory_block_t**)(block + 1) = arena->deferred;
+        arena->deferred = block;
+        arena->deferred_count++;
+        return;
+    }
+    block->size |= BLOCK_FREE;
+    merge_blocks(arena, block);
+}
+
+static memory_block_t* heap_defer_take(arena_t* arena, size_t size) {
+    size_t most = size + size / 4;
+    memory_block_t** link = &arena->deferred;
+    while (*link) {
+        memory_block_t* block = *link;
+        size_t found = block_size(block);
+        if (found >= size && found <= most) {
+            *link = *(memory_block_t**)(block + 1);
+            arena->deferred_count--;
+            block->size &= ~BLOCK_DEFERRED;
+            return block;
+        }
+        link = (memory_block_t**)(block + 1);
+    }
+    return NULL;
+}
+
+static void heap_defer_flush(arena_t* arena) {
+    memory_block_t* block = arena->deferred;
+    arena->deferred = NULL;
+    arena->deferred_count = 0;
+    while (block) {
+        memory_block_t* next = *(memory_block_t**)(block + 1);
+        block->size = (block->size & ~BLOCK_DEFERRED) | BLOCK_FREE;
+        merge_blocks(arena, block);
+        block = next;
+    }
+}
+
+static int heap_grow_block(arena_t* arena, memory_block_t* block, size_t size) {
+    memory_block_t* next = next_block(block);
+    if (!(next->size & BLOCK_FREE) || block_size(block) + BLOCK_SIZE + block_size(next) < size) {
+        return 0;
+    }
+    bin_remove(arena, next);
+    block->size += BLOCK_SIZE + block_size(next);
+    next_block(block)->prev_size = block_size(block);
+    if (block_size(block) > size + BLOCK_SIZE + ALIGNMENT) {
+        split_block(arena, block, size);
+    }
+    return 1;
+}
+
+static void* chunk_map(size_t size) {
+    // Over-map by one alignment unit and trim both ends to the aligned window
+    size_t span = size + ALLOCATOR_CHUNK_SIZE;
+    char* raw = NULL;
+    int hugetlb = 0;
+#ifdef MAP_HUGETLB
+    // Explicit huge pages need a reserved pool and whole huge pages to trim
+    if (CONFIG(huge_pages) == HUGE_PAGES_HUGETLB && (span & (HUGE_PAGE_SIZE - 1)) == 0 &&
+        (ALLOCATOR_CHUNK_SIZE & (HUGE_PAGE_SIZE - 1)) == 0) {
+        raw = os_map(span, MAP_HUGETLB);
+        hugetlb = raw != NULL;
+    }
+#endif
+    if (!raw) {
+        raw = os_map(span, 0);
+        if (!raw) {
+            return NULL;
+        }
+    }
+    char* aligned = (char*)(((uintptr_t)raw + ALLOCATOR_CHUNK_SIZE - 1) & ~(ALLOCATOR_CHUNK_SIZE - 1));
+    if (aligned > raw) {
+        os_unmap(raw, (size_t)(aligned - raw));
+    }
+    size_t tail = (size_t)((raw + span) - (aligned + size));
+    if (tail) {
+        os_unmap(aligned + size, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    if (CONFIG(huge_pages) != HUGE_PAGES_OFF && !hugetlb) {
+        // Only a hint: it fails harmlessly where transparent huge pages are disabled
+        madvise(aligned, size, MADV_HUGEPAGE);
+    }
+#endif
+    (void)hugetlb;
+    return aligned;
+}
+
+static void chunk_link(heap_chunk_t** list, heap_chunk_t* chunk) {
+    chunk->prev = NULL;
+    chunk->next = *list;
+    if (*list) {
+        (*list)->prev = chunk;
+    }
+    *list = chunk;
+}
+
+static void chunk_unlink(heap_chunk_t** list, heap_chunk_t* chunk) {
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        *list = chunk->next;
+    }
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Slabs
+ *
+ * Sizes up to TCACHE_MAX_SIZE are served from slabs without any per-object
+ * header: the object size is kept once per slab in the chunk's slab table.
+ * A slab chunk is split into SLABS_PER_CHUNK slabs; the first one gives up
+ * its start to the table.
+ * ------------------------------------------------------------------------- */
+
+static slab_t* ptr_slab(void* ptr) {
+    slab_chunk_t* chunk = (slab_chunk_t*)CHUNK_OF(ptr);
+    size_t offset = (size_t)((char*)ptr - (char*)chunk);
+    return &chunk->slabs[offset / SLAB_SIZE];
+}
+
+static int slab_chunk_create(arena_t* arena) {
+    slab_chunk_t* chunk = chunk_map(ALLOCATOR_CHUNK_SIZE);
+    if (!chunk) {
+        return -1;
+    }
+    numa_bind(chunk, ALLOCATOR_CHUNK_SIZE, arena->node);
+    chunk->header.size = ALLOCATOR_CHUNK_SIZE;
+    chunk->header.arena = arena;
+    chunk->header.kind = CHUNK_SLAB;
+    chunk->header.slabs_used = 0;
+    // Counts as just emptied, so a chunk reserved ahead of use outlives the next purge
+    chunk->header.emptied_at = now_ms();
+    chunk_link(&arena->chunks, &chunk->header);
+    // Push in reverse so the lowest slab, whose table page is already touched, is used first
+    for (int i = SLABS_PER_CHUNK - 1; i >= 0; i--) {
+        slab_t* slab = &chunk->slabs[i];
+        char* start = (char*)chunk + (size_t)i * SLAB_SIZE;
+        slab->free_list = NULL;
+        slab->bump = i == 0 ? start + SLAB_CHUNK_HEADER_SIZE : start;
+        slab->end = start + SLAB_SIZE;
+        slab->obj_size = 0;
+        slab->used = 0;
+        slab->purged = 1; // Fresh pages are not resident yet
+        slab->freed_at = arena->clock_ms;
+        slab->prev = NULL;
+        slab->next = arena->slabs_empty;
+        if (arena->slabs_empty) {
+            arena->slabs_empty->prev = slab;
+        }
+        arena->slabs_empty = slab;
+    }
+    return 0;
+}
+
+static void* slab_alloc(arena_t* arena, size_t size) {
+    size_t index = bin_index(size);
+    slab_t* slab = arena->slabs_partial[index];
+    if (!slab) {
+        if (!arena->slabs_empty && slab_chunk_create(arena) != 0) {
+            return NULL;
+        }
+        // Bind an empty slab to this class; it becomes the only partial slab
+        slab = arena->slabs_empty;
+        arena->slabs_empty = slab->next;
+        if (slab->next) {
+            slab->next->prev = NULL;
+        }
+        slab->obj_size = (uint32_t)size;
+        slab->next = NULL;
+        arena->slabs_partial[index] = slab;
+        CHUNK_OF(slab)->slabs_used++;
+    }
+    void* ptr = slab->free_list;
+    if (ptr) {
+        slab->free_list = *(void**)ptr;
+    } else {
+        ptr = slab->bump;
+        slab->bump += size;
+    }
+    slab->used++;
+    if (!slab->free_list && slab->bump + size > slab->end) {
+        // Full: drop off the partial list until an object comes back
+        arena->slabs_partial[index] = slab->next;
+        if (slab->next) {
+            slab->next->prev = NULL;
+        }
+        slab->next = NULL;
+    }
+    return ptr;
+}
+
+static void slab_free(arena_t* arena, void* ptr) {
+    slab_t* slab = ptr_slab(ptr);
+    size_t index = bin_index(slab->obj_size);
+    int was_full = !slab->free_list && slab->bump + slab->obj_size > slab->end;
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->used--;
+    if (was_full && slab->used) {
+        slab->prev = NULL;
+        slab->next = arena->slabs_partial[index];
+        if (slab->next) {
+            slab->next->prev = slab;
+        }
+        arena->slabs_partial[index] = slab;
+        return;
+    }
+    if (slab->used) {
+        return;
+    }
+    // Empty: unbind from the class so any size can reuse it
+    if (!was_full) {
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        } else {
+            arena->slabs_partial[index] = slab->next;
+        }
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+    }
+    slab_chunk_t* chunk = (slab_chunk_t*)CHUNK_OF(ptr);
+    char* start = (char*)chunk + (size_t)(slab - chunk->slabs) * SLAB_SIZE;
+    slab->free_list = NULL;
+    slab->bump = slab == chunk->slabs ? start + SLAB_CHUNK_HEADER_SIZE : start;
+    slab->obj_size = 0;
+    slab->purged = 0;
+    slab->freed_at = arena->clock_ms;
+    slab->prev = NULL;
+    slab->next = arena->slabs_empty;
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    arena->slabs_empty = slab;
+    if (--chunk->header.slabs_used == 0) {
+        chunk->header.emptied_at = arena->clock_ms;
+    }
+}
+
+static void arena_release(arena_t* arena, void* ptr) {
+    if (CHUNK_OF(ptr)->kind == CHUNK_SLAB) {
+        slab_free(arena, ptr);
+    } else {
+        heap_free_block(arena, get_block(ptr));
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Pools
+ *
+ * Each pool carves its objects out of its own chunks with a bump pointer,
+ * under the pool lock and TCACHE_BATCH objects at a time. Freed objects go
+ * to the freeing thread's slot for the pool; overflowing slots push half of
+ * their objects onto the pool's shared list, where any thread's next refill
+ * picks them up.
+ * ------------------------------------------------------------------------- */
+
+static pool_cache_t* pool_cache(tcache_t* tc, allocator_pool_t* pool) {
+    pool_cache_t* pc = &tc->pools[pool->id % POOL_CACHE_SLOTS];
+    if (pc->pool_id != pool->id) {
+        pool_cache_flush(pc);
+        pc->pool_id = pool->id;
+    }
+    return pc;
+}
+
+static unsigned int pool_refill(allocator_pool_t* pool, pool_cache_t* pc) {
+    // Taking the whole list at once leaves no ABA window for concurrent pushers
+    if (__atomic_load_n(&pool->shared_free, __ATOMIC_RELAXED)) {
+        void* ptr = __atomic_exchange_n(&pool->shared_free, NULL, __ATOMIC_ACQUIRE);
+        if (ptr) {
+            unsigned int count = 0;
+            for (void* obj = ptr; obj; obj = *(void**)obj) {
+                count++;
+            }
+            pc->head = ptr;
+            pc->count = count;
+            return count;
+        }
+    }
+    unsigned int added = 0;
+    unsigned int batch = TCACHE_BATCH;
+    pthread_mutex_lock(&pool->lock);
+    while (added < batch) {
+        if ((size_t)(pool->end - pool->bump) < pool->obj_size && pool_chunk_create(pool) != 0) {
+            break;
+        }
+        // Link a run of consecutive objects so they are handed out in address order
+        size_t room = (size_t)(pool->end - pool->bump) / pool->obj_size;
+        unsigned int count = room < batch - added ? (unsigned int)room : batch - added;
+        char* run = pool->bump;
+        for (unsigned int i = 0; i + 1 < count; i++) {
+            *(void**)(run + i * pool->obj_size) = run + (i + 1) * pool->obj_size;
+        }
+        pool->bump += (size_t)count * pool->obj_size;
+        *(void**)(pool->bump - pool->obj_size) = pc->head;
+        pc->head = run;
+        pc->count += count;
+        added += count;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return added;
+}
+
+static int pool_chunk_create(allocator_pool_t* pool) {
+    heap_chunk_t* chunk = chunk_map(ALLOCATOR_CHUNK_SIZE);
+    if (!chunk) {
+        return -1;
+    }
+    chunk->size = ALLOCATOR_CHUNK_SIZE;
+    chunk->arena = NULL;
+    chunk->pool = pool;
+    chunk->kind = CHUNK_POOL;
+    chunk_link(&pool->chunks, chunk);
+    pool->bump = (char*)chunk + ((CHUNK_HEADER_SIZE + pool->align - 1) & ~(pool->align - 1));
+    pool->end = (char*)chunk + ALLOCATOR_CHUNK_SIZE;
+    return 0;
+}
+
+static void pool_push_shared(allocator_pool_t* pool, void* head, void* tail) {
+    void* old = __atomic_load_n(&pool->shared_free, __ATOMIC_RELAXED);
+    do {
+        *(void**)tail = old;
+    } while (!__atomic_compare_exchange_n(&pool->shared_free, &old, head, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void pool_cache_flush(pool_cache_t* pc) {
+    if (pc->head) {
+        pthread_mutex_lock(&pool_mutex);
+        allocator_pool_t* pool = pool_list;
+        while (pool && pool->id != pc->pool_id) {
+            pool = pool->next;
+        }
+        if (pool) {
+            void* tail = pc->head;
+            while (*(void**)tail) {
+                tail = *(void**)tail;
+            }
+            pool_push_shared(pool, pc->head, tail);
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+    memset(pc, 0, sizeof(pool_cache_t));
+}
+
+/* -------------------------------------------------------------------------
+ * Profiler
+ * ------------------------------------------------------------------------- */
+
+#define PROF_SAMPLE_HASH(ptr) (((uintptr_t)(ptr) >> 4) % PROF_SAMPLE_BUCKETS)
+
+static void* prof_malloc(tcache_t* tc, size_t size) {
+    prof_dump_pending(tc);
+    size_t mean = CONFIG(prof_sample);
+    if (mean == 0 || tc->prof_busy) {
+        // allocator_malloc() takes size off again, leaving the countdown at or above 0
+        tc->prof_countdown = (mean ? prof_next_interval(tc, mean) : PROF_RECHECK_BYTES) + (int64_t)size;
+        return allocator_malloc(size);
+    }
+    tc->prof_countdown = prof_next_interval(tc, mean);
+    tc->prof_busy = 1;
+    // backtrace() may allocate the first time it runs; prof_busy keeps that unsampled
+    void* stack[PROF_MAX_DEPTH + 1];
+    int depth = backtrace(stack, PROF_MAX_DEPTH + 1);
+
+    // Sampled allocations never come from a slab, so free() can spot them by their header
+    void* ptr = NULL;
+    if (size > CONFIG(mmap_threshold)) {
+        ptr = huge_alloc(size, ALIGNMENT);
+        if (ptr) {
+            CHUNK_OF(ptr)->sampled = 1;
+            STAT_ADD(tc, huge_allocs, 1);
+            STAT_ADD(tc, bytes_allocated, HUGE_USABLE(CHUNK_OF(ptr)));
+        }
+    } else {
+        size_t min_size = align_size(sizeof(free_links_t));
+        arena_t* arena = arena_acquire(tc);
+        memory_block_t* block = heap_alloc_block(arena, size < min_size ? min_size : size, NULL);
+        if (block) {
+            block->size |= BLOCK_SAMPLED;
+        }
+        arena_unlock(tc, arena);
+        if (block) {
+            ptr = block + 1;
+            STAT_ADD(tc, large_allocs, 1);
+            STAT_ADD(tc, bytes_allocated, block_size(block));
+        }
+    }
+    if (ptr) {
+        // Frame 0 is prof_malloc() itself
+        prof_record(ptr, size, stack + 1, depth > 1 ? depth - 1 : 0);
+    }
+    tc->prof_busy = 0;
+    return ptr;
+}
+
+static void prof_dump_pending(tcache_t* tc) {
+    if (prof_dump_requested && !tc->prof_busy) {
+        prof_dump_requested = 0;
+        char path[64];
+        snprintf(path, sizeof(path), "mtalloc.%d.%u.heap", (int)getpid(),
+                 __atomic_fetch_add(&prof_dump_seq, 1, __ATOMIC_RELAXED));
+        allocator_prof_dump(path);
+    }
+}
+
+static int64_t prof_next_interval(tcache_t* tc, size_t mean) {
+    if (tc->prof_seed == 0) {
+        tc->prof_seed = ((uint64_t)(uintptr_t)tc * 0x9E3779B97F4A7C15ULL) | 1;
+    }
+    uint64_t x = tc->prof_seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    tc->prof_seed = x;
+
+    // -ln(u) for u uniform in (0, 1], without libm: u = m * 2^-e with m in [1, 2)
+    uint64_t bits = (x >> 11) | 1;
+    int e = 53 - (63 - __builtin_clzll(bits));
+    double m = (double)bits / (double)(1ULL << (63 - __builtin_clzll(bits)));
+    double t = (m - 1.0) / (m + 1.0);
+    double t2 = t * t;
+    double ln_m = 2.0 * t * (1.0 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7))));
+    double neg_ln_u = e * 0.69314718055994530942 - ln_m;
+    double interval = neg_ln_u * (double)mean;
+    if (interval < 1.0) {
+        return 1;
+    }
+    if (interval > (double)PTRDIFF_MAX / 2) {
+        return PTRDIFF_MAX / 2;
+    }
+    return (int64_t)interval;
+}
+
+static int prof_pools_init(void) {
+    if (__atomic_load_n(&prof_sample_pool, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    allocator_pool_t* site_pool = allocator_pool_create(sizeof(prof_site_t), 0);
+    allocator_pool_t* sample_pool = allocator_pool_create(sizeof(prof_sample_t), 0);
+    int installed = 0;
+    if (site_pool && sample_pool) {
+        pthread_mutex_lock(&prof_mutex);
+        if (!prof_sample_pool) {
+            prof_site_pool = site_pool;
+            __atomic_store_n(&prof_sample_pool, sample_pool, __ATOMIC_RELEASE);
+            installed = 1;
+        }
+        pthread_mutex_unlock(&prof_mutex);
+    }
+    if (!installed) {
+        allocator_pool_destroy(site_pool);
+        allocator_pool_destroy(sample_pool);
+    }
+    return __atomic_load_n(&prof_sample_pool, __ATOMIC_ACQUIRE) ? 0 : -1;
+}
+
+static void prof_record(void* ptr, size_t size, void** stack, int depth) {
+    if (prof_pools_init() != 0) {
+        return;
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t)stack[i]) * 1099511628211ULL;
+    }
+    pthread_mutex_lock(&prof_mutex);
+    // allocator_destroy() may have dropped the pools since prof_pools_init()
+    prof_sample_t* sample = prof_sample_pool ? allocator_pool_alloc(prof_sample_pool) : NULL;
+    if (!sample) {
+        pthread_mutex_unlock(&prof_mutex);
+        return;
+    }
+    prof_site_t** bucket = &prof_sites[hash % PROF_SITE_BUCKETS];
+    prof_site_t* site = *bucket;
+    while (site && (site->hash != hash || site->depth != depth ||
+                    memcmp(site->stack, stack, (size_t)depth * sizeof(void*)) != 0)) {
+        site = site->next;
+    }
+    if (!site) {
+        site = allocator_pool_alloc(prof_site_pool);
+        if (!site) {
+            allocator_pool_free(prof_sample_pool, sample);
+            pthread_mutex_unlock(&prof_mutex);
+            return;
+        }
+        memset(site, 0, sizeof(prof_site_t));
+        site->hash = hash;
+        site->depth = depth;
+        memcpy(site->stack, stack, (size_t)depth * sizeof(void*));
+        site->next = *bucket;
+        *bucket = site;
+    }
+    site->alloc_count++;
+    site->alloc_bytes += size;
+    site->live_count++;
+    site->live_bytes += size;
+    sample->ptr = ptr;
+    sample->size = size;
+    sample->site = site;
+    prof_sample_t** slot = &prof_samples[PROF_SAMPLE_HASH(ptr)];
+    sample->next = *slot;
+    *slot = sample;
+    pthread_mutex_unlock(&prof_mutex);
+}
+
+static void prof_forget(void* ptr) {
+    pthread_mutex_lock(&prof_mutex);
+    prof_sample_t** link = &prof_samples[PROF_SAMPLE_HASH(ptr)];
+    while (*link && (*link)->ptr != ptr) {
+        link = &(*link)->next;
+    }
+    // Missing when the record could not be allocated
+    prof_sample_t* sample = *link;
+    if (sample) {
+        *link = sample->next;
+        sample->site->live_count--;
+        sample->site->live_bytes -= sample->size;
+        allocator_pool_free(prof_sample_pool, sample);
+    }
+    pthread_mutex_unlock(&prof_mutex);
+}
+
+static void prof_resize(void* old_ptr, void* new_ptr, size_t size) {
+    pthread_mutex_lock(&prof_mutex);
+    prof_sample_t** link = &prof_samples[PROF_SAMPLE_HASH(old_ptr)];
+    while (*link && (*link)->ptr != old_ptr) {
+        link = &(*link)->next;
+    }
+    prof_sample_t* sample = *link;
+    if (sample) {
+        *link = sample->next;
+        sample->site->live_bytes += size - sample->size;
+        sample->ptr = new_ptr;
+        sample->size = size;
+        prof_sample_t** slot = &prof_samples[PROF_SAMPLE_HASH(new_ptr)];
+        sample->next = *slot;
+        *slot = sample;
+    }
+    pthread_mutex_unlock(&prof_mutex);
+}
+
+static void text_flush(text_out_t* out) {
+    size_t done = 0;
+    while (done < out->used && !out->failed) {
+        ssize_t n = write(out->fd, out->buf + done, out->used - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            out->failed = 1;
+        } else {
+            done += (size_t)n;
+        }
+    }
+    out->used = 0;
+}
+
+static void text_printf(text_out_t* out, const char* format, ...) {
+    if (sizeof(out->buf) - out->used < 256) {
+        text_flush(out);
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->buf + out->used, sizeof(out->buf) - out->used, format, args);
+    va_end(args);
+    if (n > 0) {
+        size_t room = sizeof(out->buf) - out->used - 1;
+        out->used += (size_t)n < room ? (size_t)n : room;
+    }
+}
+
+static int prof_write(int fd) {
+    text_out_t out = {.fd = fd, .failed = 0, .used = 0};
+    pthread_mutex_lock(&prof_mutex);
+    uint64_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < PROF_SITE_BUCKETS; i++) {
+        for (prof_site_t* site = prof_sites[i]; site; site = site->next) {
+            live_count += site->live_count;
+            live_bytes += site->live_bytes;
+            alloc_count += site->alloc_count;
+            alloc_bytes += site->alloc_bytes;
+        }
+    }
+    text_printf(&out, "heap profile: %" PRIu64 ": %" PRIu64 " [%" PRIu64 ": %" PRIu64 "] @ heap_v2/%zu\n",
+                live_count, live_bytes, alloc_count, alloc_bytes, CONFIG(prof_sample));
+    for (size_t i = 0; i < PROF_SITE_BUCKETS; i++) {
+        for (prof_site_t* site = prof_sites[i]; site; site = site->next) {
+            text_printf(&out, "%" PRIu64 ": %" PRIu64 " [%" PRIu64 ": %" PRIu64 "] @",
+                        site->live_count, site->live_bytes, site->alloc_count, site->alloc_bytes);
+            for (int j = 0; j < site->depth; j++) {
+                text_printf(&out, " %p", site->stack[j]);
+            }
+            text_printf(&out, "\n");
+        }
+    }
+    pthread_mutex_unlock(&prof_mutex);
+
+    // pprof symbolizes the addresses against the mappings listed here
+    text_printf(&out, "\nMAPPED_LIBRARIES:\n");
+    text_flush(&out);
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        ssize_t n;
+        while ((n = read(maps, out.buf, sizeof(out.buf))) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) {
+                out.used = (size_t)n;
+                text_flush(&out);
+            }
+        }
+        close(maps);
+    }
+    return out.failed ? -1 : 0;
+}
+
+static void prof_signal_handler(int sig) {
+    (void)sig;
+    prof_dump_requested = 1;
+}
+
+/* -------------------------------------------------------------------------
+ * Configuration
+ *
+ * Settings start from the config.h defaults. MTALLOC_CONF is applied once,
+ * before the first allocation or allocator_config_*() call, and
+ * allocator_config_set() may override them later. MTALLOC_CONF holds
+ * name:value pairs separated by commas, e.g. "arenas:4,decay_ms:0".
+ * ------------------------------------------------------------------------- */
+
+static int config_apply(const char* name, size_t len, size_t value) {
+#define CONFIG_IS(key) (len == sizeof(key) - 1 && memcmp(name, key, len) == 0)
+    if (CONFIG_IS("arenas")) {
+        // The arena array is sized once; later changes would strand chunks
+        if (value > ALLOCATOR_MAX_ARENAS || __atomic_load_n(&arena_count, __ATOMIC_ACQUIRE)) {
+            return -1;
+        }
+        config.arenas = value;
+    } else if (CONFIG_IS("tcache_max")) {
+        if (value < 1 || value > TCACHE_BIN_LIMIT) {
+            return -1;
+        }
+        __atomic_store_n(&config.tcache_max, value, __ATOMIC_RELAXED);
+    } else if (CONFIG_IS("decay_ms")) {
+        __atomic_store_n(&config.decay_ms, value, __ATOMIC_RELAXED);
+    } else if (CONFIG_IS("huge_pages")) {
+        if (value > HUGE_PAGES_HUGETLB) {
+            return -1;
+        }
+        __atomic_store_n(&config.huge_pages, value, __ATOMIC_RELAXED);
+    } else if (CONFIG_IS("coalesce_defer")) {
+        if (value > DEFER_LIMIT) {
+            return -1;
+        }
+        __atomic_store_n(&config.coalesce_defer, value, __ATOMIC_RELAXED);
+    } else if (CONFIG_IS("background_thread")) {
+        if (value > 1) {
+            return -1;
+        }
+        __atomic_store_n(&config.background_thread, value, __ATOMIC_RELAXED);
+    } else if (CONFIG_IS("mmap_threshold")) {
+        // Small sizes always use slabs, and the compiled-in value, at most half
+        // a chunk, is the ceiling
+        if (value < TCACHE_MAX_SIZE || value > ALLOCATOR_MMAP_THRESHOLD) {
+            return -1;
+        }
+        __atomic_store_n(&config.mmap_threshold, value, __ATOMIC_RELAXED);
+    } else if (CONFIG_IS("prof_sample")) {
+        __atomic_store_n(&config.prof_sample, value, __ATOMIC_RELAXED);
+    } else if (CONFIG_IS("prof_signal")) {
+        if (value >= NSIG || value == SIGKILL || value == SIGSTOP) {
+            return -1;
+        }
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        // Give a previously chosen signal its default action back
+        size_t old = CONFIG(prof_signal);
+        if (old && old != value) {
+            action.sa_handler = SIG_DFL;
+            sigaction((int)old, &action, NULL);
+        }
+        if (value) {
+            action.sa_handler = prof_signal_handler;
+            if (sigaction((int)value, &action, NULL) != 0) {
+                return -1;
+            }
+        }
+        __atomic_store_n(&config.prof_signal, value, __ATOMIC_RELAXED);
+    } else {
+        return -1;
+    }
+    return 0;
+#undef CONFIG_IS
+}
+
+static void config_load_env(void) {
+    const char* env = getenv("MTALLOC_CONF");
+    if (!env) {
+        return;
+    }
+    // Malformed, out of range or rejected pairs are skipped so the rest still
+    // apply. Values go through config_apply(), as allocator_config_set()'s do
+    while (*env) {
+        const char* name = env;
+        while (*env && *env != ':' && *env != ',') {
+            env++;
+        }
+        size_t len = (size_t)(env - name);
+        if (*env == ':') {
+            env++;
+            size_t value = 0;
+            int digits = 0;
+            int overflow = 0;
+            while (*env >= '0' && *env <= '9') {
+                size_t digit = (size_t)(*env - '0');
+                if (value > (SIZE_MAX - digit) / 10) {
+                    overflow = 1;
+                }
+                value = value * 10 + digit;
+                env++;
+                digits++;
+            }
+            if (digits && !overflow && (*env == ',' || *env == '\0')) {
+                config_apply(name, len, value);
+            }
+        }
+        while (*env && *env != ',') {
+            env++;
+        }
+        if (*env == ',') {
+            env++;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Arenas
+ *
+ * Each arena is an independent heap. Threads are bound round-robin to the
+ * arenas of the NUMA node they first run on, and move to another arena of
+ * that node when their own stays contended.
+ * ------------------------------------------------------------------------- */
+
+static void arena_setup(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    if (page > 0) {
+        page_size = (size_t)page;
+    }
+    pthread_once(&config_once, config_load_env);
+    node_count = ALLOCATOR_NUMA ? numa_node_count() : 1;
+    if (node_count > ALLOCATOR_MAX_ARENAS) {
+        node_count = ALLOCATOR_MAX_ARENAS;
+    }
+    unsigned int count = config.arenas ? (unsigned int)config.arenas : (unsigned int)cpus;
+    count = count < ALLOCATOR_MAX_ARENAS ? count : ALLOCATOR_MAX_ARENAS;
+    // Every node gets the same number of arenas, and at least one
+    count -= count % node_count;
+    if (count < node_count) {
+        count = node_count;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        arenas[i].index = i;
+        arenas[i].node = (int)(i % node_count);
+    }
+    // The calling thread binds to its node's first arena next, so give it a
+    // slab chunk now instead of in the middle of its first small allocation
+    slab_chunk_create(&arenas[numa_current_node()]);
+    pthread_atfork(allocator_prefork, allocator_postfork_parent, allocator_postfork_child);
+    // Published last: a non-zero count tells allocator_config_set() the arenas exist
+    __atomic_store_n(&arena_count, count, __ATOMIC_RELEASE);
+}
+
+static arena_t* arena_for_node(int node) {
+    unsigned int per_node = arena_count / node_count;
+    unsigned int slot = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % per_node;
+    return &arenas[(unsigned int)node + slot * node_count];
+}
+
+static arena_t* arena_acquire(tcache_t* tc) {
+    arena_t* arena = tc->arena;
+    if (pthread_mutex_trylock(&arena->lock) == 0) {
+        tc->contended = 0;
+        trace_lock_acquired(tc, arena, 0);
+    } else {
+        STAT_ADD(tc, lock_contentions, 1);
+        uint64_t wait_start = trace_now_ns();
+        arena_t* other = NULL;
+        if (++tc->contended >= ARENA_SWITCH_THRESHOLD) {
+            // Rebind to the first arena on the same node that is free right now, if any
+            tc->contended = 0;
+            for (unsigned int i = node_count; i < arena_count; i += node_count) {
+                arena_t* candidate = &arenas[(arena->index + i) % arena_count];
+                if (pthread_mutex_trylock(&candidate->lock) == 0) {
+                    other = candidate;
+                    break;
+                }
+            }
+        }
+        if (other) {
+            tc->arena = other;
+            arena = other;
+        } else {
+            pthread_mutex_lock(&arena->lock);
+        }
+        trace_lock_acquired(tc, arena, wait_start);
+    }
+    arena_decay(arena);
+    arena_drain_remote(arena);
+    return arena;
+}
+
+static void arena_remote_push(arena_t* arena, void* head, void* tail) {
+    void* old = __atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED);
+    do {
+        *(void**)tail = old;
+    } while (!__atomic_compare_exchange_n(&arena->remote_free, &old, head, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void arena_drain_remote(arena_t* arena) {
+    // Cheap check first so the common empty case does not dirty the cache line
+    if (!__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+        return;
+    }
+    // Taking the whole list at once leaves no ABA window for concurrent pushers
+    void* ptr = __atomic_exchange_n(&arena->remote_free, NULL, __ATOMIC_ACQUIRE);
+    while (ptr) {
+        void* next = *(void**)ptr;
+        arena_release(arena, ptr);
+        ptr = next;
+    }
+}
+
+static void arena_lock(tcache_t* tc, arena_t* arena) {
+    if (pthread_mutex_trylock(&arena->lock) == 0) {
+        trace_lock_acquired(tc, arena, 0);
+    } else {
+        STAT_ADD(tc, lock_contentions, 1);
+        uint64_t wait_start = trace_now_ns();
+        pthread_mutex_lock(&arena->lock);
+        trace_lock_acquired(tc, arena, wait_start);
+    }
+}
+
+static void arena_unlock(tcache_t* tc, arena_t* arena) {
+#if ALLOCATOR_TRACE
+    uint64_t held = trace_now_ns() - arena->locked_ns;
+    pthread_mutex_unlock(&arena->lock);
+    trace_record(&tc->stats.lock_hold, held);
+    TRACE_PROBE(lock_hold, arena->index, held);
+#else
+    (void)tc;
+    pthread_mutex_unlock(&arena->lock);
+#endif
+}
+
+/* -------------------------------------------------------------------------
+ * NUMA placement
+ *
+ * The topology is read from sysfs and pages are placed with the raw getcpu
+ * and mbind system calls, so there is no dependency on libnuma. Elsewhere
+ * everything falls back to a single node.
+ * ------------------------------------------------------------------------- */
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+static unsigned int numa_node_count(void) {
+#if defined(__linux__)
+    char buf[256];
+    int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 1;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return 1;
+    }
+    // A list of ranges such as "0-1,3": the highest number is the last node
+    unsigned int highest = 0;
+    unsigned int value = 0;
+    for (ssize_t i = 0; i <= len; i++) {
+        if (i < len && buf[i] >= '0' && buf[i] <= '9') {
+            value = value * 10 + (unsigned int)(buf[i] - '0');
+        } else {
+            highest = value > highest ? value : highest;
+            value = 0;
+        }
+    }
+    return highest + 1;
+#else
+    return 1;
+#endif
+}
+
+static int numa_current_node(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned int cpu;
+    unsigned int node;
+    if (node_count > 1 && syscall(SYS_getcpu, &cpu, &node, NULL) == 0 && node < node_count) {
+        return (int)node;
+    }
+#endif
+    return 0;
+}
+
+static void numa_bind(void* addr, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (node_count <= 1) {
+        return;
+    }
+    unsigned long mask[(ALLOCATOR_MAX_ARENAS + 63) / 64] = {0};
+    mask[node / 64] = 1UL << (node % 64);
+    syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask, sizeof(mask) * 8, MPOL_MF_MOVE);
+#else
+    (void)addr;
+    (void)size;
+    (void)node;
+#endif
+}
+
+/* -------------------------------------------------------------------------
+ * Statistics
+ *
+ * Calls into the OS are rare and counted with shared atomics. Everything on
+ * the allocation fast path is counted per thread in tcache_t::stats; live
+ * threads sit on stats_threads and fold their counters into stats_retired
+ * when they exit.
+ * ------------------------------------------------------------------------- */
+
+static void* os_map(size_t size, int flags) {
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    __atomic_fetch_add(&os_stats.mmap_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&os_stats.mapped_bytes, size, __ATOMIC_RELAXED);
+    return addr;
+}
+
+static void os_unmap(void* addr, size_t size) {
+    munmap(addr, size);
+    __atomic_fetch_add(&os_stats.munmap_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&os_stats.mapped_bytes, size, __ATOMIC_RELAXED);
+}
+
+static size_t os_purge(void* addr, size_t size) {
+    if (madvise(addr, size, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+    __atomic_fetch_add(&os_stats.purged_bytes, size, __ATOMIC_RELAXED);
+    return size;
+}
+
+static void stats_merge(allocator_stats_t* stats, tcache_stats_t* counters) {
+    for (size_t i = 0; i < TCACHE_NUM_BINS; i++) {
+        stats->small_allocs[i] += __atomic_load_n(&counters->small_allocs[i], __ATOMIC_RELAXED);
+        stats->small_frees[i] += __atomic_load_n(&counters->small_frees[i], __ATOMIC_RELAXED);
+    }
+    stats->large_allocs += __atomic_load_n(&counters->large_allocs, __ATOMIC_RELAXED);
+    stats->large_frees += __atomic_load_n(&counters->large_frees, __ATOMIC_RELAXED);
+    stats->huge_allocs += __atomic_load_n(&counters->huge_allocs, __ATOMIC_RELAXED);
+    stats->huge_frees += __atomic_load_n(&counters->huge_frees, __ATOMIC_RELAXED);
+    stats->cache_hits += __atomic_load_n(&counters->cache_hits, __ATOMIC_RELAXED);
+    stats->cache_misses += __atomic_load_n(&counters->cache_misses, __ATOMIC_RELAXED);
+    stats->lock_contentions += __atomic_load_n(&counters->lock_contentions, __ATOMIC_RELAXED);
+    // Frees may be counted by another thread than the allocation, so only the total is meaningful
+    stats->live_bytes += __atomic_load_n(&counters->bytes_allocated, __ATOMIC_RELAXED);
+    stats->live_bytes -= __atomic_load_n(&counters->bytes_freed, __ATOMIC_RELAXED);
+#if ALLOCATOR_TRACE
+    allocator_latency_t* from[] = {&counters->lock_wait, &counters->lock_hold, &counters->os_map};
+    allocator_latency_t* into[] = {&stats->lock_wait, &stats->lock_hold, &stats->os_map};
+    for (size_t h = 0; h < sizeof(from) / sizeof(from[0]); h++) {
+        into[h]->count += __atomic_load_n(&from[h]->count, __ATOMIC_RELAXED);
+        into[h]->total_ns += __atomic_load_n(&from[h]->total_ns, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < ALLOCATOR_LATENCY_BUCKETS; i++) {
+            into[h]->buckets[i] += __atomic_load_n(&from[h]->buckets[i], __ATOMIC_RELAXED);
+        }
+    }
+#endif
+}
+
+static uint64_t latency_bucket_limit(size_t index) {
+    if (index < 8) {
+        return index;
+    }
+    if (index >= ALLOCATOR_LATENCY_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    unsigned int shift = (unsigned int)(index / 8) - 1;
+    return ((9 + (uint64_t)(index % 8)) << shift) - 1;
+}
+
+/* -------------------------------------------------------------------------
+ * Heap walk
+ *
+ * A heap chunk is walked block by block from its first header to the fence,
+ * a slab chunk slab by slab. The remote free list is drained first so blocks
+ * freed by other threads show up as free.
+ * ------------------------------------------------------------------------- */
+
+static int heap_walk_arena(arena_t* arena, allocator_heap_walk_fn callback, void* ctx) {
+    for (heap_chunk_t* chunk = arena->chunks; chunk; chunk = chunk->next) {
+        allocator_heap_block_t info;
+        memset(&info, 0, sizeof(info));
+        info.arena = arena->index;
+        info.mapping = chunk;
+        info.mapping_size = chunk->size;
+        int result = 0;
+        if (chunk->kind == CHUNK_SLAB) {
+            info.kind = ALLOCATOR_WALK_SLAB;
+            slab_chunk_t* slabs = (slab_chunk_t*)chunk;
+            for (int i = 0; i < SLABS_PER_CHUNK && !result; i++) {
+                slab_t* slab = &slabs->slabs[i];
+                char* start = (char*)chunk + (size_t)i * SLAB_SIZE;
+                info.addr = i == 0 ? start + SLAB_CHUNK_HEADER_SIZE : start;
+                info.size = (size_t)(slab->end - (char*)info.addr);
+                info.free = slab->obj_size == 0;
+                info.obj_size = slab->obj_size;
+                info.objects_used = slab->used;
+                result = callback(&info, ctx);
+            }
+        } else {
+            info.kind = ALLOCATOR_WALK_HEAP;
+            memory_block_t* block = (memory_block_t*)((char*)chunk + CHUNK_HEADER_SIZE);
+            while (block_size(block) != 0 && !result) {
+                info.addr = block + 1;
+                info.size = block_size(block);
+                info.free = (block->size & (BLOCK_FREE | BLOCK_DEFERRED)) != 0;
+                result = callback(&info, ctx);
+                block = next_block(block);
+            }
+        }
+        if (result) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+static int heap_summary_add(const allocator_heap_block_t* block, void* ctx) {
+    heap_summary_ctx_t* state = ctx;
+    allocator_heap_summary_t* summary = state->summary;
+    // The blocks of a mapping are walked one after another
+    if (block->mapping != state->mapping) {
+        state->mapping = block->mapping;
+        summary->mappings++;
+        summary->mapped_bytes += block->mapping_size;
+    }
+    if (block->kind == ALLOCATOR_WALK_SLAB) {
+        summary->used_bytes += block->obj_size * block->objects_used;
+    } else if (!block->free) {
+        summary->used_bytes += block->size;
+    } else {
+        summary->free_bytes += block->size;
+        summary->free_blocks++;
+        if (block->size > summary->largest_free) {
+            summary->largest_free = block->size;
+        }
+        size_t index = 63 - (size_t)__builtin_clzll(block->size);
+        summary->free_histogram[index < ALLOCATOR_FREE_CLASSES ? index : ALLOCATOR_FREE_CLASSES - 1]++;
+    }
+    return 0;
+}
+
+static int heap_report_add(const allocator_heap_block_t* block, void* ctx) {
+    heap_report_ctx_t* report = ctx;
+    if (block->mapping != report->first.mapping) {
+        heap_report_mapping(report);
+        report->first = *block;
+        report->used = 0;
+        report->free_blocks = 0;
+        report->largest_free = 0;
+    }
+    if (block->kind == ALLOCATOR_WALK_SLAB) {
+        report->used += block->obj_size * block->objects_used;
+    } else if (!block->free) {
+        report->used += block->size;
+    } else {
+        report->free_blocks++;
+        if (block->size > report->largest_free) {
+            report->largest_free = block->size;
+        }
+    }
+    return 0;
+}
+
+static void heap_report_mapping(heap_report_ctx_t* report) {
+    const allocator_heap_block_t* first = &report->first;
+    if (first->mapping == NULL) {
+        return;
+    }
+    double used = 100.0 * (double)report->used / (double)first->mapping_size;
+    if (first->kind == ALLOCATOR_WALK_HUGE) {
+        text_printf(report->out, "  %p huge: %zu bytes, %.1f%% used\n", first->mapping,
+                    first->mapping_size, used);
+    } else if (first->kind == ALLOCATOR_WALK_SLAB) {
+        text_printf(report->out, "  %p slab arena %u: %zu bytes, %.1f%% used\n", first->mapping,
+                    first->arena, first->mapping_size, used);
+    } else {
+        text_printf(report->out, "  %p heap arena %u: %zu bytes, %.1f%% used, %zu free blocks, largest %zu\n",
+                    first->mapping, first->arena, first->mapping_size, used, report->free_blocks,
+                    report->largest_free);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Tracing
+ *
+ * Built with ALLOCATOR_TRACE, arena lock waits and holds and the chunk
+ * mappings of a growing heap are timed into the per-thread histograms in
+ * tcache_t::stats. Each measurement also fires a USDT probe of the mtalloc
+ * provider when <sys/sdt.h> is available, e.g. for bpftrace:
+ *
+ *     usdt:./libmtalloc.so:mtalloc:lock_wait  arg0 = arena index, arg1 = ns
+ *     usdt:./libmtalloc.so:mtalloc:lock_hold  arg0 = arena index, arg1 = ns
+ *     usdt:./libmtalloc.so:mtalloc:os_map     arg0 = bytes, arg1 = ns
+ *
+ * Built without it, these helpers are empty and compile away.
+ * ------------------------------------------------------------------------- */
+
+static uint64_t trace_now_ns(void) {
+#if ALLOCATOR_TRACE
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+#if ALLOCATOR_TRACE
+static size_t latency_bucket(uint64_t ns) {
+    if (ns < 8) {
+        return (size_t)ns;
+    }
+    // The top bit picks the power of two, the three bits below it the eighth
+    unsigned int top = 63 - (unsigned int)__builtin_clzll(ns);
+    size_t index = (size_t)(top - 2) * 8 + ((ns >> (top - 3)) & 7);
+    return index < ALLOCATOR_LATENCY_BUCKETS ? index : ALLOCATOR_LATENCY_BUCKETS - 1;
+}
+
+static void trace_record(allocator_latency_t* latency, uint64_t ns) {
+    size_t index = latency_bucket(ns);
+    __atomic_store_n(&latency->buckets[index], latency->buckets[index] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&latency->count, latency->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&latency->total_ns, latency->total_ns + ns, __ATOMIC_RELAXED);
+}
+#endif
+
+static void trace_lock_acquired(tcache_t* tc, arena_t* arena, uint64_t wait_start) {
+#if ALLOCATOR_TRACE
+    uint64_t now = trace_now_ns();
+    uint64_t waited = wait_start ? now - wait_start : 0;
+    arena->locked_ns = now;
+    trace_record(&tc->stats.lock_wait, waited);
+    TRACE_PROBE(lock_wait, arena->index, waited);
+#else
+    (void)tc;
+    (void)arena;
+    (void)wait_start;
+#endif
+}
+
+/* -------------------------------------------------------------------------
+ * Purging
+ *
+ * Free memory is returned to the OS once it has sat unused for
+ * the decay_ms setting. The arena clock advances whenever a thread locks the
+ * arena, so an idle arena keeps its pages until allocator_trim() is called.
+ * Only blocks in the large bins are considered; smaller ones never span a
+ * whole page.
+ * ------------------------------------------------------------------------- */
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    // Millisecond resolution is plenty and the coarse clock is much cheaper
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void arena_decay(arena_t* arena) {
+    uint64_t decay_ms = CONFIG(decay_ms);
+    if (decay_ms == 0) {
+        return;
+    }
+    uint64_t now = now_ms();
+    arena->clock_ms = now;
+    // The background thread purges on its own schedule while it runs
+    if (now < arena->next_purge_ms || __atomic_load_n(&background_running, __ATOMIC_RELAXED)) {
+        return;
+    }
+    arena->next_purge_ms = now + decay_ms;
+    arena_purge(arena, now > decay_ms ? now - decay_ms : 0);
+}
+
+static size_t arena_purge(arena_t* arena, uint64_t cutoff) {
+    // Purging part of a huge page would split it, so release whole ones only
+    uintptr_t page_mask = (CONFIG(huge_pages) != HUGE_PAGES_OFF ? HUGE_PAGE_SIZE : (uintptr_t)page_size) - 1;
+    size_t released = 0;
+    for (size_t index = SMALL_BIN_COUNT; index < NUM_BINS; index++) {
+        memory_block_t* block = arena->bins[index];
+        while (block) {
+            free_links_t* links = FREE_LINKS(block);
+            memory_block_t* next = links->next_free;
+            if (links->freed_at > cutoff) {
+                block = next;
+                continue;
+            }
+            if (block_size(block) == CHUNK_BLOCK_SIZE) {
+                released += chunk_release(arena, block);
+            } else if (!links->purged) {
+                // Keep the header and bin links resident, release whole pages past them
+                uintptr_t start = ((uintptr_t)(links + 1) + page_mask) & ~page_mask;
+                uintptr_t end = (uintptr_t)next_block(block) & ~page_mask;
+                if (end > start) {
+                    released += os_purge((void*)start, end - start);
+                }
+                links->purged = 1;
+            }
+            block = next;
+        }
+    }
+    heap_chunk_t* chunk = arena->chunks;
+    while (chunk) {
+        heap_chunk_t* next = chunk->next;
+        if (chunk->kind == CHUNK_SLAB && chunk->slabs_used == 0 && chunk->emptied_at <= cutoff) {
+            released += slab_chunk_release(arena, chunk);
+        }
+        chunk = next;
+    }
+    for (slab_t* slab = arena->slabs_empty; slab; slab = slab->next) {
+        if (slab->purged || slab->freed_at > cutoff) {
+            continue;
+        }
+        // The slab table at the start of the first slab stays resident
+        uintptr_t start = ((uintptr_t)slab->bump + page_mask) & ~page_mask;
+        uintptr_t end = (uintptr_t)slab->end;
+        if (end > start) {
+            released += os_purge((void*)start, end - start);
+        }
+        slab->purged = 1;
+    }
+    return released;
+}
+
+static size_t chunk_release(arena_t* arena, memory_block_t* block) {
+    heap_chunk_t* chunk = CHUNK_OF(block);
+    bin_remove(arena, block);
+    chunk_unlink(&arena->chunks, chunk);
+    size_t size = chunk->size;
+    os_unmap(chunk, size);
+    return size;
+}
+
+static size_t slab_chunk_release(arena_t* arena, heap_chunk_t* chunk) {
+    // Every slab of an unused chunk is on the empty list
+    slab_t* slabs = ((slab_chunk_t*)chunk)->slabs;
+    for (int i = 0; i < SLABS_PER_CHUNK; i++) {
+        slab_t* slab = &slabs[i];
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        } else {
+            arena->slabs_empty = slab->next;
+        }
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+    }
+    chunk_unlink(&arena->chunks, chunk);
+    size_t size = chunk->size;
+    os_unmap(chunk, size);
+    return size;
+}
+
+/* -------------------------------------------------------------------------
+ * Huge allocations
+ *
+ * Requests above the mmap_threshold setting get a mapping of their own that is
+ * unmapped as soon as it is freed. The mapping starts with a CHUNK_HUGE
+ * header and is chunk-aligned like every other mapping, so free() can tell
+ * it apart by masking. They are tracked on huge_list, under huge_mutex, only
+ * so that allocator_destroy() can release them.
+ * ------------------------------------------------------------------------- */
+
+static void* huge_alloc(size_t size, size_t alignment) {
+    size_t offset = (CHUNK_HEADER_SIZE + alignment - 1) & ~(alignment - 1);
+    size_t total_size = (offset + size + page_size - 1) & ~(page_size - 1);
+    heap_chunk_t* chunk = chunk_map(total_size);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->size = total_size;
+    chunk->arena = NULL;
+    chunk->kind = CHUNK_HUGE;
+    chunk->offset = offset;
+    chunk->sampled = 0;
+    pthread_mutex_lock(&huge_mutex);
+    chunk_link(&huge_list, chunk);
+    pthread_mutex_unlock(&huge_mutex);
+    return HUGE_PAYLOAD(chunk);
+}
+
+static void huge_free(heap_chunk_t* chunk) {
+    pthread_mutex_lock(&huge_mutex);
+    chunk_unlink(&huge_list, chunk);
+    pthread_mutex_unlock(&huge_mutex);
+    os_unmap(chunk, chunk->size);
+}
+
+static void* huge_realloc(heap_chunk_t* chunk, size_t size) {
+    size_t old_size = chunk->size;
+    size_t new_size = (chunk->offset + size + page_size - 1) & ~(page_size - 1);
+    if (new_size == old_size) {
+        return HUGE_PAYLOAD(chunk);
+    }
+#if defined(__linux__) && defined(MREMAP_MAYMOVE) && defined(MREMAP_FIXED)
+    // The kernel moves page table entries, so no payload bytes are copied
+    pthread_mutex_lock(&huge_mutex);
+    chunk_unlink(&huge_list, chunk);
+    heap_chunk_t* moved = mremap(chunk, old_size, new_size, 0);
+    // chunk_map() counted the new window, so a move only drops the old one
+    size_t added = new_size - old_size;
+    if (moved == MAP_FAILED) {
+        // Cannot grow in place: move into a fresh aligned window, which
+        // MREMAP_FIXED replaces atomically
+        void* target = chunk_map(new_size);
+        moved = target ? mremap(chunk, old_size, new_size, MREMAP_MAYMOVE | MREMAP_FIXED, target)
+                       : MAP_FAILED;
+        if (moved == MAP_FAILED) {
+            if (target) {
+                os_unmap(target, new_size);
+            }
+            chunk_link(&huge_list, chunk);
+            pthread_mutex_unlock(&huge_mutex);
+            return NULL;
+        }
+        added = -old_size;
+    }
+    moved->size = new_size;
+    chunk_link(&huge_list, moved);
+    __atomic_fetch_add(&os_stats.mremap_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&os_stats.mapped_bytes, added, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&huge_mutex);
+    return HUGE_PAYLOAD(moved);
+#else
+    return NULL;
+#endif
+}
+
+/* -------------------------------------------------------------------------
+ * Thread cache
+ *
+ * Small blocks are cached per thread by size class. Hits never take an arena
+ * lock; misses and overflows move TCACHE_BATCH blocks at a time.
+ * ------------------------------------------------------------------------- */
+
+static void tcache_key_init(void) {
+    pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+static tcache_t* tcache_get(void) {
+    tcache_t* tc = &tcache;
+    if (tc->generation != heap_generation) {
+        memset(tc->bins, 0, sizeof(tc->bins));
+        tc->generation = heap_generation;
+    }
+    if (!tc->registered) {
+        pthread_once(&arena_once, arena_setup);
+        pthread_once(&tcache_key_once, tcache_key_init);
+        pthread_setspecific(tcache_key, tc);
+        tc->arena = arena_for_node(numa_current_node());
+        pthread_mutex_lock(&stats_mutex);
+        tc->stats_prev = NULL;
+        tc->stats_next = stats_threads;
+        if (stats_threads) {
+            stats_threads->stats_prev = tc;
+        }
+        stats_threads = tc;
+        pthread_mutex_unlock(&stats_mutex);
+        tc->registered = 1;
+    }
+    return tc;
+}
+
+static void* tcache_alloc(tcache_t* tc, size_t index, size_t size) {
+    if (tc->gc_epoch != __atomic_load_n(&background_epoch, __ATOMIC_RELAXED)) {
+        tcache_gc(tc);
+    }
+    tcache_bin_t* bin = &tc->bins[index];
+    if (bin->head) {
+        STAT_ADD(tc, cache_hits, 1);
+    } else {
+        STAT_ADD(tc, cache_misses, 1);
+        if (!tcache_refill(tc, bin, size)) {
+            return NULL;
+        }
+    }
+    void* ptr = bin->head;
+    bin->head = *(void**)ptr;
+    bin->count--;
+    if (bin->count < bin->low_water) {
+        bin->low_water = bin->count;
+    }
+    STAT_ADD(tc, small_allocs[index], 1);
+    STAT_ADD(tc, bytes_allocated, size);
+    return ptr;
+}
+
+static int tcache_refill(tcache_t* tc, tcache_bin_t* bin, size_t size) {
+    int added = 0;
+    int batch = (int)TCACHE_BATCH;
+    arena_t* arena = arena_acquire(tc);
+    while (added < batch) {
+        void* ptr = slab_alloc(arena, size);
+        if (!ptr) {
+            break;
+        }
+        *(void**)ptr = bin->head;
+        bin->head = ptr;
+        bin->count++;
+        added++;
+    }
+    arena_unlock(tc, arena);
+    return added;
+}
+
+static void tcache_put(tcache_t* tc, void* ptr, size_t size) {
+    if (tc->gc_epoch != __atomic_load_n(&background_epoch, __ATOMIC_RELAXED)) {
+        tcache_gc(tc);
+    }
+    size_t index = bin_index(size);
+    tcache_bin_t* bin = &tc->bins[index];
+    if (bin->count >= CONFIG(tcache_max)) {
+        tcache_flush(tc, index, TCACHE_BATCH);
+    }
+    *(void**)ptr = bin->head;
+    bin->head = ptr;
+    bin->count++;
+    STAT_ADD(tc, small_frees[index], 1);
+    STAT_ADD(tc, bytes_freed, size);
+}
+
+static void tcache_flush(tcache_t* tc, size_t index, unsigned int count) {
+    tcache_bin_t* bin = &tc->bins[index];
+    if (count > bin->count) {
+        count = bin->count;
+    }
+    // Keep the most recently freed (cache-hot) blocks, release the older tail
+    unsigned int keep = bin->count - count;
+    void** link = &bin->head;
+    for (unsigned int i = 0; i < keep; i++) {
+        link = (void**)*link;
+    }
+    void* ptr = *link;
+    *link = NULL;
+    bin->count = keep;
+    if (bin->low_water > keep) {
+        bin->low_water = keep;
+    }
+
+    // Release consecutive runs of blocks with the same owner together: runs
+    // from this thread's arena are freed under its lock, runs from other
+    // arenas are pushed onto the owner's remote list in one atomic operation
+    while (ptr) {
+        arena_t* owner = CHUNK_OF(ptr)->arena;
+        void* run = ptr;
+        void* tail = ptr;
+        ptr = *(void**)ptr;
+        while (ptr && CHUNK_OF(ptr)->arena == owner) {
+            tail = ptr;
+            ptr = *(void**)ptr;
+        }
+        if (owner != tc->arena) {
+            arena_remote_push(owner, run, tail);
+            continue;
+        }
+        *(void**)tail = NULL;
+        arena_lock(tc, owner);
+        arena_decay(owner);
+        while (run) {
+            void* next = *(void**)run;
+            slab_free(owner, run);
+            run = next;
+        }
+        arena_unlock(tc, owner);
+    }
+}
+
+static void tcache_gc(tcache_t* tc) {
+    tc->gc_epoch = __atomic_load_n(&background_epoch, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < TCACHE_NUM_BINS; i++) {
+        // Blocks the bin never dipped into since the last pass were not needed
+        tcache_bin_t* bin = &tc->bins[i];
+        unsigned int unused = bin->low_water - bin->low_water / 4;
+        if (unused) {
+            tcache_flush(tc, i, unused);
+        }
+        bin->low_water = bin->count;
+    }
+}
+
+static void tcache_thread_exit(void* arg) {
+    tcache_t* tc = (tcache_t*)arg;
+    // Flushed now: the background thread only trims caches of threads still running
+    if (tc->generation == heap_generation) {
+        for (size_t i = 0; i < TCACHE_NUM_BINS; i++) {
+            tcache_flush(tc, i, tc->bins[i].count);
+        }
+    }
+    for (size_t i = 0; i < POOL_CACHE_SLOTS; i++) {
+        pool_cache_flush(&tc->pools[i]);
+    }
+
+    // tcache_stats_t holds nothing but uint64_t counters
+    pthread_mutex_lock(&stats_mutex);
+    uint64_t* from = (uint64_t*)&tc->stats;
+    uint64_t* into = (uint64_t*)&stats_retired;
+    for (size_t i = 0; i < sizeof(tcache_stats_t) / sizeof(uint64_t); i++) {
+        into[i] += from[i];
+    }
+    if (tc->stats_prev) {
+        tc->stats_prev->stats_next = tc->stats_next;
+    } else {
+        stats_threads = tc->stats_next;
+    }
+    if (tc->stats_next) {
+        tc->stats_next->stats_prev = tc->stats_prev;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+    // A later destructor that allocates registers again, which re-arms this one
+    memset(&tc->stats, 0, sizeof(tcache_stats_t));
+    tc->registered = 0;
+}
+
+/* -------------------------------------------------------------------------
+ * Background thread
+ *
+ * With the background_thread setting on, allocator_init() starts a thread
+ * that wakes every ALLOCATOR_BACKGROUND_INTERVAL_MS. It drains the remote
+ * free lists, purges decayed pages and bumps background_epoch, which makes
+ * every thread trim its cache bins on its next allocator call. Thread
+ * caches have no lock, so only their owner may touch them.
+ * ------------------------------------------------------------------------- */
+
+static int background_start(void) {
+    pthread_mutex_lock(&background_mutex);
+    if (background_running) {
+        pthread_mutex_unlock(&background_mutex);
+        return 0;
+    }
+    // Keep process signals, such as prof_signal, away from the new thread
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    background_stopping = 0;
+    int rc = pthread_create(&background_tid, NULL, background_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc == 0) {
+        __atomic_store_n(&background_running, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&background_mutex);
+    return rc == 0 ? 0 : -1;
+}
+
+static void background_stop(void) {
+    pthread_mutex_lock(&background_mutex);
+    if (!background_running) {
+        pthread_mutex_unlock(&background_mutex);
+        return;
+    }
+    background_stopping = 1;
+    pthread_cond_signal(&background_cond);
+    pthread_mutex_unlock(&background_mutex);
+    pthread_join(background_tid, NULL);
+    __atomic_store_n(&background_running, 0, __ATOMIC_RELAXED);
+}
+
+static void* background_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&background_mutex);
+    while (!background_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += ALLOCATOR_BACKGROUND_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (long)(ALLOCATOR_BACKGROUND_INTERVAL_MS % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&background_cond, &background_mutex, &deadline);
+        if (background_stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&background_mutex);
+        background_pass();
+        pthread_mutex_lock(&background_mutex);
+    }
+    pthread_mutex_unlock(&background_mutex);
+    return NULL;
+}
+
+static void background_pass(void) {
+    uint64_t decay_ms = CONFIG(decay_ms);
+    uint64_t now = now_ms();
+    for (unsigned int i = 0; i < arena_count; i++) {
+        arena_t* arena = &arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        arena_drain_remote(arena);
+        if (decay_ms && now >= arena->next_purge_ms) {
+            arena->clock_ms = now;
+            arena->next_purge_ms = now + decay_ms;
+            arena_purge(arena, now > decay_ms ? now - decay_ms : 0);
+        }
+        pthread_mutex_unlock(&arena->lock);
+    }
+    __atomic_add_fetch(&background_epoch, 1, __ATOMIC_RELAXED);
+    prof_dump_pending(tcache_get());
+}
@@ -0,0 +1,258 @@
+/**
+ * @file malloc_shim.c
+ * @brief Standard malloc interface for preloading.
+ *
+ * Built into libmtalloc.so, this file exports the C and POSIX allocation
+ * functions on top of the allocator_* API, so existing programs pick the
+ * allocator up without code changes:
+ *
+ *     LD_PRELOAD=build/lib/libmtalloc.so ./program
+ *
+ * Allocations made while the allocator is itself running (for instance by
+ * libc while a thread cache is being set up) are served from a small static
+ * bootstrap heap instead of recursing.
+ *
+ * With MTALLOC_RECORD=path set, every call is recorded to path.<pid> for
+ * benchmarks/trace_replay, see allocator_record_start().
+ *
+ * @author Ameed Othman
+ * @date 14/10/2026
+ */
+#include "allocator.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SHIM_ALIGNMENT 16         // Alignment malloc() guarantees, as in allocator.c
+#define BOOTSTRAP_SIZE (64 * 1024) // Bytes available to re-entrant allocations
+
+static char bootstrap_heap[BOOTSTRAP_SIZE] __attribute__((aligned(SHIM_ALIGNMENT)));
+static size_t bootstrap_used = 0;
+
+// Non-zero while the calling thread is inside the allocator
+static __thread int shim_depth __attribute__((tls_model("initial-exec")));
+
+/**
+ * @brief Carves an allocation out of the bootstrap heap.
+ *
+ * Each allocation is preceded by its size. Bootstrap memory is zeroed and is
+ * never reused, so only a handful of early allocations should land here.
+ *
+ * @param alignment Required alignment, a power of two.
+ * @param size The requested size in bytes.
+ * @return void* Pointer to the allocation, or NULL if the bootstrap heap is exhausted.
+ */
+static void* bootstrap_alloc(size_t alignment, size_t size) {
+    if (alignment < SHIM_ALIGNMENT) {
+        alignment = SHIM_ALIGNMENT;
+    }
+    uintptr_t base = (uintptr_t)bootstrap_heap;
+    size_t used = __atomic_load_n(&bootstrap_used, __ATOMIC_RELAXED);
+    size_t start;
+    do {
+        start = ((base + used + sizeof(size_t) + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+        if (start > BOOTSTRAP_SIZE || size > BOOTSTRAP_SIZE - start) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&bootstrap_used, &used, start + size, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    ((size_t*)(bootstrap_heap + start))[-1] = size;
+    return bootstrap_heap + start;
+}
+
+static int in_bootstrap(void* ptr) {
+    return (char*)ptr >= bootstrap_heap && (char*)ptr < bootstrap_heap + BOOTSTRAP_SIZE;
+}
+
+/**
+ * @brief Allocates through the allocator, or the bootstrap heap when re-entered.
+ *
+ * Zero-sized requests get a unique pointer, as callers of malloc() expect.
+ *
+ * @param alignment Required alignment, a power of two.
+ * @param size The requested size in bytes.
+ * @return void* Pointer to the allocation, or NULL with errno set to ENOMEM.
+ */
+static void* shim_alloc(size_t alignment, size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    void* ptr;
+    if (shim_depth) {
+        ptr = bootstrap_alloc(alignment, size);
+    } else {
+        shim_depth++;
+        ptr = alignment <= SHIM_ALIGNMENT ? allocator_malloc(size)
+                                          : allocator_aligned_alloc(alignment, size);
+        if (ptr) {
+            allocator_record_event(alignment <= SHIM_ALIGNMENT ? ALLOCATOR_RECORD_MALLOC : ALLOCATOR_RECORD_ALIGNED,
+                                   ptr, NULL, size, alignment, 0);
+        }
+        shim_depth--;
+    }
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* malloc(size_t size) {
+    return shim_alloc(SHIM_ALIGNMENT, size);
+}
+
+void free(void* ptr) {
+    if (ptr == NULL || in_bootstrap(ptr)) {
+        return;
+    }
+    shim_depth++;
+    allocator_record_event(ALLOCATOR_RECORD_FREE, ptr, NULL, 0, 0, 0);
+    allocator_free(ptr);
+    shim_depth--;
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t total_size = nmemb * size;
+    if (shim_depth) {
+        // Bootstrap memory is already zero
+        return shim_alloc(SHIM_ALIGNMENT, total_size);
+    }
+    shim_depth++;
+    void* ptr = allocator_calloc(1, total_size ? total_size : 1);
+    if (ptr) {
+        allocator_record_event(ALLOCATOR_RECORD_CALLOC, ptr, NULL, total_size, 0, 0);
+    }
+    shim_depth--;
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return shim_alloc(SHIM_ALIGNMENT, size);
+    }
+    if (in_bootstrap(ptr)) {
+        size_t old_size = ((size_t*)ptr)[-1];
+        void* new_ptr = shim_alloc(SHIM_ALIGNMENT, size);
+        if (new_ptr) {
+            memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        }
+        return new_ptr;
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    shim_depth++;
+    // ptr may be handed to another thread before allocator_realloc() returns
+    uint64_t begin_ns = allocator_record_clock();
+    void* new_ptr = allocator_realloc(ptr, size);
+    if (new_ptr) {
+        allocator_record_event(ALLOCATOR_RECORD_REALLOC, new_ptr, ptr, size, 0, begin_ns);
+    }
+    shim_depth--;
+    if (!new_ptr) {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+void* reallocarray(void* ptr, size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1))) {
+        return EINVAL;
+    }
+    int saved_errno = errno;
+    void* ptr = shim_alloc(alignment, size);
+    errno = saved_errno;
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return shim_alloc(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    // Like glibc, round an alignment that is not a power of two up to one
+    size_t power = SHIM_ALIGNMENT;
+    while (power < alignment) {
+        if (power > SIZE_MAX / 2) {
+            errno = EINVAL;
+            return NULL;
+        }
+        power <<= 1;
+    }
+    return shim_alloc(power, size);
+}
+
+void* valloc(size_t size) {
+    return shim_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page_size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return shim_alloc(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+size_t malloc_usable_size(void* ptr) {
+    if (ptr && in_bootstrap(ptr)) {
+        return ((size_t*)ptr)[-1];
+    }
+    return allocator_usable_size(ptr);
+}
+
+/**
+ * @brief Sets the allocator up before main(), applies MTALLOC_CONF and starts recording.
+ *
+ * allocator_init() registers the fork handlers and starts the background
+ * thread if MTALLOC_CONF asks for it. Whatever libc allocates meanwhile
+ * comes from the bootstrap heap.
+ */
+__attribute__((constructor)) static void shim_init(void) {
+    shim_depth++;
+    allocator_init();
+    const char* record = getenv("MTALLOC_RECORD");
+    if (record && *record) {
+        // The pid keeps the programs a recorded process runs from sharing its file
+        char path[4096];
+        if (snprintf(path, sizeof(path), "%s.%d", record, (int)getpid()) < (int)sizeof(path)) {
+            allocator_record_start(path);
+        }
+    }
+    shim_depth--;
+}
+
+/**
+ * @brief Writes out the remaining recorded calls when the process exits.
+ */
+__attribute__((destructor)) static void shim_fini(void) {
+    allocator_record_stop();
+}
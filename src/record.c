@@ -0,0 +1,430 @@
+/**
+ * @file record.c
+ * @brief Recording of allocation calls for replay.
+ *
+ * A thread that records gets a record_thread_t, kept for the life of the
+ * process and taken over by another thread once its own exits, and fills
+ * buffers of RECORD_BUFFER_EVENTS entries without taking a lock. Full
+ * buffers go on a queue that a writer thread appends to the file, so a
+ * recorded call costs a clock read and a few stores. Buffers come straight
+ * from mmap(), so recording neither re-enters the allocator nor changes the
+ * heap it records.
+ *
+ * A thread sets its busy flag while it records a call and then checks
+ * record_active. allocator_record_stop() clears record_active and then waits
+ * for each thread's busy flag before it takes the thread's partial buffer,
+ * so every call is either recorded in full or not at all.
+ *
+ * @author Ameed Othman
+ * @date 14/10/2026
+ */
+#include "allocator.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define RECORD_BUFFER_EVENTS 4096     // Entries per buffer, 192 KiB
+#define RECORD_THREADS_PER_MAP 64     // record_thread_t entries mapped at a time
+
+/**
+ * @brief A batch of entries from one thread.
+ */
+typedef struct record_buffer {
+    struct record_buffer* next;       // Next buffer on the queue or the spare list
+    size_t count;                     // Entries filled
+    allocator_record_t events[RECORD_BUFFER_EVENTS];
+} record_buffer_t;
+
+/**
+ * @brief Recording state of one thread.
+ */
+typedef struct record_thread {
+    struct record_thread* next;       // Next in record_threads
+    record_buffer_t* buffer;          // Buffer being filled, NULL until the thread next records
+    uint32_t id;                      // allocator_record_t::thread
+    int busy;                         // Set while the thread records a call
+    int in_use;                       // Cleared when the thread exits
+} record_thread_t;
+
+static int record_active = 0;
+static int record_fd = -1;
+static int record_failed = 0;         // Set when an entry was lost or a write failed
+static uint64_t record_start_ns = 0;
+
+// Every record_thread_t ever mapped. record_mutex protects the list and
+// in_use, and serialises starting and stopping
+static record_thread_t* record_threads = NULL;
+static uint32_t record_thread_count = 0;
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Full buffers waiting for the writer, and spare ones, protected by queue_mutex
+static record_buffer_t* queue_head = NULL;
+static record_buffer_t* queue_tail = NULL;
+static record_buffer_t* spare_buffers = NULL;
+static int writer_stopping = 0;
+static pthread_t writer_thread;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread record_thread_t* record_self;
+static pthread_key_t record_key;
+static pthread_once_t record_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @return uint64_t Nanoseconds from an arbitrary origin.
+ */
+static uint64_t record_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Writes all of a buffer to a file descriptor.
+ *
+ * @return int Returns 0 on success, -1 on a write error.
+ */
+static int record_write(int fd, const void* data, size_t size) {
+    const char* next = (const char*)data;
+    while (size) {
+        ssize_t written = write(fd, next, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        next += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Takes a spare buffer, or maps a new one.
+ *
+ * @return record_buffer_t* An empty buffer, or NULL if none can be mapped.
+ */
+static record_buffer_t* record_buffer_get(void) {
+    pthread_mutex_lock(&queue_mutex);
+    record_buffer_t* buffer = spare_buffers;
+    if (buffer) {
+        spare_buffers = buffer->next;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    if (!buffer) {
+        buffer = mmap(NULL, sizeof(record_buffer_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            __atomic_store_n(&record_failed, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+    buffer->next = NULL;
+    buffer->count = 0;
+    return buffer;
+}
+
+/**
+ * @brief Queues a buffer for the writer thread.
+ */
+static void record_buffer_submit(record_buffer_t* buffer) {
+    pthread_mutex_lock(&queue_mutex);
+    buffer->next = NULL;
+    if (queue_tail) {
+        queue_tail->next = buffer;
+    } else {
+        queue_head = buffer;
+    }
+    queue_tail = buffer;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+/**
+ * @brief Body of the writer thread: appends queued buffers to the file until stopped.
+ */
+static void* record_writer(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_mutex);
+    for (;;) {
+        while (!queue_head && !writer_stopping) {
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        }
+        record_buffer_t* batch = queue_head;
+        if (!batch) {
+            break;
+        }
+        queue_head = NULL;
+        queue_tail = NULL;
+        pthread_mutex_unlock(&queue_mutex);
+
+        record_buffer_t* last = batch;
+        for (record_buffer_t* buffer = batch; buffer; buffer = buffer->next) {
+            if (record_write(record_fd, buffer->events, buffer->count * sizeof(allocator_record_t)) != 0) {
+                __atomic_store_n(&record_failed, 1, __ATOMIC_RELAXED);
+            }
+            last = buffer;
+        }
+
+        pthread_mutex_lock(&queue_mutex);
+        last->next = spare_buffers;
+        spare_buffers = batch;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Thread exit destructor: queues the thread's partial buffer and frees its slot.
+ */
+static void record_thread_exit(void* arg) {
+    record_thread_t* self = (record_thread_t*)arg;
+    __atomic_store_n(&self->busy, 1, __ATOMIC_SEQ_CST);
+    // Once recording is off, allocator_record_stop() takes the buffer instead
+    if (self->buffer && __atomic_load_n(&record_active, __ATOMIC_SEQ_CST)) {
+        if (self->buffer->count) {
+            record_buffer_submit(self->buffer);
+            self->buffer = NULL;
+        }
+    }
+    __atomic_store_n(&self->busy, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&record_mutex);
+    self->in_use = 0;
+    pthread_mutex_unlock(&record_mutex);
+    record_self = NULL;
+}
+
+/**
+ * @brief Gives the calling thread a record_thread_t, reusing one of an exited thread if possible.
+ *
+ * @return record_thread_t* The thread's state, or NULL if none can be mapped.
+ */
+static record_thread_t* record_thread_attach(void) {
+    pthread_mutex_lock(&record_mutex);
+    record_thread_t* self = record_threads;
+    while (self && self->in_use) {
+        self = self->next;
+    }
+    if (!self) {
+        record_thread_t* block = mmap(NULL, RECORD_THREADS_PER_MAP * sizeof(record_thread_t),
+                                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) {
+            __atomic_store_n(&record_failed, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&record_mutex);
+            return NULL;
+        }
+        // Mapped memory is zero, so each entry starts idle and without a buffer
+        for (int i = RECORD_THREADS_PER_MAP - 1; i >= 0; i--) {
+            block[i].id = record_thread_count + (uint32_t)i;
+            block[i].next = record_threads;
+            record_threads = &block[i];
+        }
+        record_thread_count += RECORD_THREADS_PER_MAP;
+        self = block;
+    }
+    self->in_use = 1;
+    pthread_mutex_unlock(&record_mutex);
+    record_self = self;
+    pthread_setspecific(record_key, self);
+    return self;
+}
+
+/**
+ * @brief Takes the recording locks so that no fork happens while one is held.
+ */
+static void record_prefork(void) {
+    pthread_mutex_lock(&record_mutex);
+    pthread_mutex_lock(&queue_mutex);
+}
+
+/**
+ * @brief Releases the recording locks in the parent after fork().
+ */
+static void record_postfork_parent(void) {
+    pthread_mutex_unlock(&queue_mutex);
+    pthread_mutex_unlock(&record_mutex);
+}
+
+/**
+ * @brief Stops recording in the child after fork(), keeping the parent's file intact.
+ */
+static void record_postfork_child(void) {
+    // The writer and every other thread are gone; the child does not record
+    pthread_mutex_init(&queue_mutex, NULL);
+    pthread_mutex_init(&record_mutex, NULL);
+    pthread_cond_init(&queue_cond, NULL);
+    if (__atomic_load_n(&record_active, __ATOMIC_RELAXED)) {
+        close(record_fd);
+    }
+    record_active = 0;
+    record_fd = -1;
+    queue_head = NULL;
+    queue_tail = NULL;
+    for (record_thread_t* thread = record_threads; thread; thread = thread->next) {
+        thread->buffer = NULL;
+        thread->busy = 0;
+        thread->in_use = thread == record_self;
+    }
+}
+
+/**
+ * @brief Creates the thread exit key and registers the fork handlers, once per process.
+ */
+static void record_setup(void) {
+    pthread_key_create(&record_key, record_thread_exit);
+    pthread_atfork(record_prefork, record_postfork_parent, record_postfork_child);
+}
+
+int allocator_record_start(const char* path) {
+    if (!path) {
+        return -1;
+    }
+    pthread_once(&record_once, record_setup);
+    pthread_mutex_lock(&record_mutex);
+    if (record_active) {
+        pthread_mutex_unlock(&record_mutex);
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        pthread_mutex_unlock(&record_mutex);
+        return -1;
+    }
+    allocator_record_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ALLOCATOR_RECORD_MAGIC, sizeof(header.magic));
+    header.version = ALLOCATOR_RECORD_VERSION;
+    header.record_size = sizeof(allocator_record_t);
+    if (record_write(fd, &header, sizeof(header)) != 0) {
+        close(fd);
+        pthread_mutex_unlock(&record_mutex);
+        return -1;
+    }
+    record_fd = fd;
+    record_failed = 0;
+    writer_stopping = 0;
+
+    // Keep process signals away from the writer
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&writer_thread, NULL, record_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        close(fd);
+        record_fd = -1;
+        pthread_mutex_unlock(&record_mutex);
+        return -1;
+    }
+    record_start_ns = record_now_ns();
+    __atomic_store_n(&record_active, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&record_mutex);
+    return 0;
+}
+
+int allocator_record_stop(void) {
+    pthread_mutex_lock(&record_mutex);
+    if (!record_active) {
+        pthread_mutex_unlock(&record_mutex);
+        return -1;
+    }
+    __atomic_store_n(&record_active, 0, __ATOMIC_SEQ_CST);
+    for (record_thread_t* thread = record_threads; thread; thread = thread->next) {
+        while (__atomic_load_n(&thread->busy, __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+        record_buffer_t* buffer = thread->buffer;
+        thread->buffer = NULL;
+        if (buffer && buffer->count) {
+            record_buffer_submit(buffer);
+        } else if (buffer) {
+            pthread_mutex_lock(&queue_mutex);
+            buffer->next = spare_buffers;
+            spare_buffers = buffer;
+            pthread_mutex_unlock(&queue_mutex);
+        }
+    }
+
+    pthread_mutex_lock(&queue_mutex);
+    writer_stopping = 1;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    pthread_join(writer_thread, NULL);
+
+    int failed = __atomic_load_n(&record_failed, __ATOMIC_RELAXED);
+    if (close(record_fd) != 0) {
+        failed = 1;
+    }
+    record_fd = -1;
+    // Nothing records now, so the spare buffers can go back to the OS
+    while (spare_buffers) {
+        record_buffer_t* next = spare_buffers->next;
+        munmap(spare_buffers, sizeof(record_buffer_t));
+        spare_buffers = next;
+    }
+    pthread_mutex_unlock(&record_mutex);
+    return failed ? -1 : 0;
+}
+
+uint64_t allocator_record_clock(void) {
+    return __atomic_load_n(&record_active, __ATOMIC_RELAXED) ? record_now_ns() : 0;
+}
+
+void allocator_record_event(unsigned int op, const void* ptr, const void* old_ptr, size_t size, size_t alignment,
+                            uint64_t begin_ns) {
+    if (!__atomic_load_n(&record_active, __ATOMIC_RELAXED)) {
+        return;
+    }
+    record_thread_t* self = record_self;
+    if (!self) {
+        self = record_thread_attach();
+        if (!self) {
+            return;
+        }
+    }
+    // Either allocator_record_stop() sees busy set, or this sees record_active cleared
+    __atomic_store_n(&self->busy, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&record_active, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&self->busy, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    if (!self->buffer) {
+        self->buffer = record_buffer_get();
+    }
+    record_buffer_t* buffer = self->buffer;
+    if (buffer) {
+        allocator_record_t* event = &buffer->events[buffer->count++];
+        event->time_ns = record_now_ns() - record_start_ns;
+        event->release_ns = event->time_ns;
+        if (op == ALLOCATOR_RECORD_REALLOC) {
+            if (begin_ns >= record_start_ns) {
+                event->release_ns = begin_ns - record_start_ns;
+            } else {
+                // Another thread may have been given old_ptr before recording started
+                op = ALLOCATOR_RECORD_MALLOC;
+                old_ptr = NULL;
+            }
+        }
+        event->ptr = (uint64_t)(uintptr_t)ptr;
+        event->old_ptr = (uint64_t)(uintptr_t)old_ptr;
+        event->size = size;
+        event->thread = self->id;
+        event->op = (uint16_t)op;
+        event->align_shift = op == ALLOCATOR_RECORD_ALIGNED && alignment ? (uint16_t)__builtin_ctzl(alignment) : 0;
+        if (buffer->count == RECORD_BUFFER_EVENTS) {
+            record_buffer_submit(buffer);
+            self->buffer = NULL;
+        }
+    }
+    __atomic_store_n(&self->busy, 0, __ATOMIC_RELEASE);
+}
@@ -14,7 +14,14 @@
 
 #include "unity.h"
 #include "allocator.h"
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 /* -------------------------------------------------------------------------
  * Test Fixture Setup and Teardown
@@ -156,6 +163,759 @@ void test_allocator_realloc_zero_size(void) {
     }
 }
 
+void test_allocator_reuses_freed_large_block(void) {
+    // Keep a neighbour live so the freed block has to be found in a bin
+    void* first = allocator_malloc(4096);
+    void* second = allocator_malloc(4096);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+
+    allocator_free(first);
+    void* reused = allocator_malloc(4096);
+    TEST_ASSERT_EQUAL_PTR(first, reused);
+    if (reused != first) {
+        TEST_FAIL_MESSAGE("Freed block was not reused for a same-sized request.");
+    }
+
+    allocator_free(reused);
+    allocator_free(second);
+}
+
+void test_allocator_small_blocks_share_pages(void) {
+    enum { COUNT = 256 };
+    void* ptrs[COUNT];
+    unsigned char* lowest = NULL;
+    unsigned char* highest = NULL;
+
+    for (int i = 0; i < COUNT; i++) {
+        ptrs[i] = allocator_malloc(16);
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+        unsigned char* p = (unsigned char*)ptrs[i];
+        if (!lowest || p < lowest) {
+            lowest = p;
+        }
+        if (!highest || p > highest) {
+            highest = p;
+        }
+    }
+
+    // Blocks are carved from shared chunks rather than mapped a page at a time
+    TEST_ASSERT_TRUE((size_t)(highest - lowest) < COUNT * 64);
+    if ((size_t)(highest - lowest) >= COUNT * 64) {
+        TEST_FAIL_MESSAGE("Small allocations are not packed together.");
+    }
+
+    for (int i = 0; i < COUNT; i++) {
+        allocator_free(ptrs[i]);
+    }
+}
+
+void test_allocator_realloc_huge(void) {
+    size_t initial_size = 2 * 1024 * 1024;
+    size_t larger_size = 16 * 1024 * 1024;
+    size_t smaller_size = 64;
+    unsigned char pattern = 0x3C;
+
+    unsigned char* ptr = (unsigned char*)allocator_malloc(initial_size);
+    TEST_ASSERT_NOT_NULL(ptr);
+    memset(ptr, pattern, initial_size);
+
+    // Grows through mremap() on Linux; the contents must survive either way
+    unsigned char* grown = (unsigned char*)allocator_realloc(ptr, larger_size);
+    TEST_ASSERT_NOT_NULL(grown);
+    TEST_ASSERT_EQUAL_HEX8(pattern, grown[0]);
+    TEST_ASSERT_EQUAL_HEX8(pattern, grown[initial_size - 1]);
+    grown[larger_size - 1] = pattern;
+
+    // Shrinking below the mmap threshold moves the data back onto the heap
+    unsigned char* shrunk = (unsigned char*)allocator_realloc(grown, smaller_size);
+    TEST_ASSERT_NOT_NULL(shrunk);
+    for (size_t i = 0; i < smaller_size; i++) {
+        TEST_ASSERT_EQUAL_HEX8(pattern, shrunk[i]);
+        if (shrunk[i] != pattern) {
+            TEST_FAIL_MESSAGE("Data corrupted after resizing a huge allocation.");
+        }
+    }
+
+    allocator_free(shrunk);
+}
+
+void test_allocator_realloc_grows_in_place(void) {
+    unsigned char pattern = 0x6D;
+    unsigned char* ptr = (unsigned char*)allocator_malloc(4096);
+    TEST_ASSERT_NOT_NULL(ptr);
+    memset(ptr, pattern, 4096);
+
+    // The rest of the chunk follows the block, so each step absorbs part of it
+    for (size_t size = 8192; size <= 512 * 1024; size *= 2) {
+        unsigned char* grown = (unsigned char*)allocator_realloc(ptr, size);
+        TEST_ASSERT_EQUAL_PTR(ptr, grown);
+        if (grown != ptr) {
+            TEST_FAIL_MESSAGE("Realloc moved a block that could grow in place.");
+        }
+        memset(grown + size / 2, pattern, size / 2);
+    }
+    for (size_t i = 0; i < 512 * 1024; i += 4096) {
+        TEST_ASSERT_EQUAL_HEX8(pattern, ptr[i]);
+    }
+
+    // Shrinking returns the tail without moving either
+    TEST_ASSERT_EQUAL_PTR(ptr, allocator_realloc(ptr, 2048));
+    TEST_ASSERT_EQUAL_HEX8(pattern, ptr[2047]);
+    allocator_free(ptr);
+}
+
+void test_allocator_small_objects_have_no_header(void) {
+    enum { COUNT = 512, SIZE = 16 };
+    unsigned char* lowest = NULL;
+    unsigned char* highest = NULL;
+    void* ptrs[COUNT];
+
+    for (int i = 0; i < COUNT; i++) {
+        ptrs[i] = allocator_malloc(SIZE);
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+        unsigned char* p = (unsigned char*)ptrs[i];
+        if (!lowest || p < lowest) {
+            lowest = p;
+        }
+        if (!highest || p > highest) {
+            highest = p;
+        }
+    }
+
+    // A fresh slab packs 16-byte objects back to back, with no header between them
+    TEST_ASSERT_EQUAL_UINT64((COUNT - 1) * SIZE, (size_t)(highest - lowest));
+    if ((size_t)(highest - lowest) != (COUNT - 1) * SIZE) {
+        TEST_FAIL_MESSAGE("Small objects are not packed without headers.");
+    }
+
+    for (int i = 0; i < COUNT; i++) {
+        allocator_free(ptrs[i]);
+    }
+}
+
+void test_allocator_coalesces_adjacent_free_blocks(void) {
+    // A live guard after the run keeps the merged block from reaching the chunk's tail
+    void* a = allocator_malloc(4096);
+    void* b = allocator_malloc(4096);
+    void* c = allocator_malloc(4096);
+    void* guard = allocator_malloc(4096);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_NOT_NULL(c);
+    TEST_ASSERT_NOT_NULL(guard);
+
+    // Freeing the middle block last merges it with both neighbours at once
+    allocator_free(a);
+    allocator_free(c);
+    allocator_free(b);
+    void* merged = allocator_malloc(3 * 4096);
+    TEST_ASSERT_EQUAL_PTR(a, merged);
+    if (merged != a) {
+        TEST_FAIL_MESSAGE("Adjacent free blocks were not coalesced.");
+    }
+
+    allocator_free(merged);
+    allocator_free(guard);
+}
+
+void test_allocator_deferred_coalescing(void) {
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_set("coalesce_defer", 1025));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("coalesce_defer", 8));
+    size_t value = 0;
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_get("coalesce_defer", &value));
+    TEST_ASSERT_EQUAL_size_t(8, value);
+
+    void* a = allocator_malloc(4096);
+    void* b = allocator_malloc(4096);
+    void* c = allocator_malloc(4096);
+    void* guard = allocator_malloc(4096);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_NOT_NULL(c);
+    TEST_ASSERT_NOT_NULL(guard);
+
+    // Deferred blocks keep their size, so the same request gets one back as it is
+    allocator_free(a);
+    allocator_free(c);
+    allocator_free(b);
+    void* again = allocator_malloc(4096);
+    TEST_ASSERT_EQUAL_PTR(b, again);
+    allocator_free(again);
+
+    // A request none of them fits coalesces the list first
+    void* merged = allocator_malloc(3 * 4096);
+    TEST_ASSERT_EQUAL_PTR(a, merged);
+
+    allocator_free(merged);
+    allocator_free(guard);
+    allocator_trim();
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("coalesce_defer", 0));
+}
+
+void test_allocator_trim_releases_free_memory(void) {
+    size_t size = 512 * 1024;
+    unsigned char* ptr = (unsigned char*)allocator_malloc(size);
+    TEST_ASSERT_NOT_NULL(ptr);
+    memset(ptr, 0x7E, size);
+    allocator_free(ptr);
+
+    // The freed pages are recent, but an explicit trim ignores the decay delay
+    size_t released = allocator_trim();
+    TEST_ASSERT_TRUE(released >= size);
+    if (released < size) {
+        TEST_FAIL_MESSAGE("allocator_trim did not release the freed block.");
+    }
+
+    // Nothing is left to release, and the heap is still usable afterwards
+    TEST_ASSERT_EQUAL_UINT64(0, allocator_trim());
+    ptr = (unsigned char*)allocator_malloc(size);
+    TEST_ASSERT_NOT_NULL(ptr);
+    memset(ptr, 0x7E, size);
+    allocator_free(ptr);
+}
+
+void test_allocator_stats_track_allocations(void) {
+    allocator_stats_t before;
+    allocator_stats_t during;
+    allocator_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+
+    // 100 bytes rounds up to the 112-byte class, index 6
+    void* small = allocator_malloc(100);
+    void* large = allocator_malloc(4096);
+    TEST_ASSERT_NOT_NULL(small);
+    TEST_ASSERT_NOT_NULL(large);
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&during));
+    TEST_ASSERT_EQUAL_UINT64(before.small_allocs[6] + 1, during.small_allocs[6]);
+    TEST_ASSERT_EQUAL_UINT64(before.large_allocs + 1, during.large_allocs);
+    TEST_ASSERT_EQUAL_UINT64(before.live_bytes + 112 + 4096, during.live_bytes);
+    TEST_ASSERT_TRUE(during.mapped_bytes >= during.live_bytes);
+    TEST_ASSERT_TRUE(during.mmap_calls > 0);
+
+    allocator_free(small);
+    allocator_free(large);
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    TEST_ASSERT_EQUAL_UINT64(before.small_frees[6] + 1, after.small_frees[6]);
+    TEST_ASSERT_EQUAL_UINT64(before.large_frees + 1, after.large_frees);
+    TEST_ASSERT_EQUAL_UINT64(before.live_bytes, after.live_bytes);
+    if (after.live_bytes != before.live_bytes) {
+        TEST_FAIL_MESSAGE("live_bytes did not return to its starting value.");
+    }
+
+    // A mapping right after a huge block makes growing it move the block
+    char* huge = allocator_malloc(8 * 1024 * 1024);
+    TEST_ASSERT_NOT_NULL(huge);
+    size_t huge_size = allocator_usable_size(huge);
+    char* guard = mmap(huge + huge_size, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT_TRUE(guard != MAP_FAILED);
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+    char* moved = allocator_realloc(huge, 2 * huge_size);
+    TEST_ASSERT_NOT_NULL(moved);
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    munmap(guard, 4096);
+    if (guard == huge + huge_size) {
+        TEST_ASSERT_TRUE(moved != huge);
+    }
+    TEST_ASSERT_EQUAL_UINT64(before.mapped_bytes + allocator_usable_size(moved) - huge_size, after.mapped_bytes);
+    allocator_free(moved);
+
+    TEST_ASSERT_EQUAL_INT(-1, allocator_get_stats(NULL));
+}
+
+void test_allocator_aligned_alloc(void) {
+    const size_t alignments[] = {64, 4096};
+    const size_t sizes[] = {48, 3000, 100000, 2 * 1024 * 1024};
+    void* ptrs[2][4];
+
+    // Small, heap and huge requests all honour the alignment
+    for (int a = 0; a < 2; a++) {
+        for (int s = 0; s < 4; s++) {
+            ptrs[a][s] = allocator_aligned_alloc(alignments[a], sizes[s]);
+            TEST_ASSERT_NOT_NULL(ptrs[a][s]);
+            TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptrs[a][s] % alignments[a]);
+            memset(ptrs[a][s], 0x5A, sizes[s]);
+        }
+    }
+    for (int a = 0; a < 2; a++) {
+        for (int s = 0; s < 4; s++) {
+            allocator_free(ptrs[a][s]);
+        }
+    }
+
+    // The padding goes back to the bins instead of staying in the block
+    allocator_stats_t before;
+    allocator_stats_t during;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+    void* page = NULL;
+    TEST_ASSERT_EQUAL_INT(0, allocator_posix_memalign(&page, 4096, 4096));
+    TEST_ASSERT_NOT_NULL(page);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)page % 4096);
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&during));
+    TEST_ASSERT_EQUAL_UINT64(before.live_bytes + 4096, during.live_bytes);
+    allocator_free(page);
+
+    void* bad = NULL;
+    TEST_ASSERT_EQUAL_INT(EINVAL, allocator_posix_memalign(&bad, 24, 64));
+    TEST_ASSERT_EQUAL_INT(EINVAL, allocator_posix_memalign(&bad, 2, 64));
+    TEST_ASSERT_NULL(bad);
+    TEST_ASSERT_NULL(allocator_aligned_alloc(48, 64));
+}
+
+void test_allocator_free_sized_and_usable_size(void) {
+    // 100 bytes rounds up to the 112-byte class
+    void* small = allocator_malloc(100);
+    TEST_ASSERT_NOT_NULL(small);
+    TEST_ASSERT_EQUAL_UINT64(112, allocator_usable_size(small));
+    memset(small, 0x3C, allocator_usable_size(small));
+
+    // The sized free puts the object in its class, so the next request reuses it
+    allocator_free_sized(small, 100);
+    TEST_ASSERT_EQUAL_PTR(small, allocator_malloc(100));
+    allocator_free_sized(small, 100);
+
+    void* large = allocator_malloc(5000);
+    TEST_ASSERT_NOT_NULL(large);
+    TEST_ASSERT_EQUAL_UINT64(5008, allocator_usable_size(large));
+    allocator_free_sized(large, 5000);
+
+    size_t huge_size = 2 * 1024 * 1024 + 1;
+    void* huge = allocator_malloc(huge_size);
+    TEST_ASSERT_NOT_NULL(huge);
+    size_t usable = allocator_usable_size(huge);
+    TEST_ASSERT_TRUE(usable >= huge_size);
+    memset(huge, 0x3C, usable);
+    allocator_free_sized(huge, huge_size);
+
+    TEST_ASSERT_EQUAL_UINT64(0, allocator_usable_size(NULL));
+    allocator_free_sized(NULL, 16);
+}
+
+void test_allocator_batch_alloc_and_free(void) {
+    enum { COUNT = 256 };
+    const size_t sizes[] = {48, 4096};
+    void* ptrs[COUNT];
+    allocator_stats_t before;
+    allocator_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+
+    for (int s = 0; s < 2; s++) {
+        TEST_ASSERT_EQUAL_UINT64(COUNT, allocator_malloc_batch(sizes[s], COUNT, ptrs));
+        for (int i = 0; i < COUNT; i++) {
+            TEST_ASSERT_NOT_NULL(ptrs[i]);
+            memset(ptrs[i], i, sizes[s]);
+        }
+        // Every block is distinct, so none was overwritten by another
+        for (int i = 0; i < COUNT; i++) {
+            TEST_ASSERT_EQUAL_HEX8((unsigned char)i, ((unsigned char*)ptrs[i])[sizes[s] - 1]);
+        }
+        ptrs[COUNT / 2] = NULL;
+        allocator_free_batch(ptrs, COUNT);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    TEST_ASSERT_EQUAL_UINT64(before.live_bytes + 48 + 4096, after.live_bytes);
+    TEST_ASSERT_EQUAL_UINT64(0, allocator_malloc_batch(0, COUNT, ptrs));
+}
+
+void test_allocator_calloc_clears_reused_memory(void) {
+    enum { SIZE = 64 * 1024 };
+    // Fresh heap memory is handed out without clearing
+    unsigned char* fresh = (unsigned char*)allocator_calloc(SIZE / 16, 16);
+    TEST_ASSERT_NOT_NULL(fresh);
+    for (size_t i = 0; i < SIZE; i++) {
+        TEST_ASSERT_EQUAL_HEX8(0, fresh[i]);
+    }
+    memset(fresh, 0xA5, SIZE);
+    allocator_free(fresh);
+
+    // The dirty block comes back and must be cleared this time
+    unsigned char* reused = (unsigned char*)allocator_calloc(SIZE / 16, 16);
+    TEST_ASSERT_EQUAL_PTR(fresh, reused);
+    for (size_t i = 0; i < SIZE; i++) {
+        TEST_ASSERT_EQUAL_HEX8(0, reused[i]);
+    }
+    allocator_free(reused);
+
+    TEST_ASSERT_NULL(allocator_calloc(SIZE_MAX / 2, 4));
+    TEST_ASSERT_NULL(allocator_malloc(SIZE_MAX));
+}
+
+void test_allocator_malloc_onnode(void) {
+    const size_t sizes[] = {64, 4096, 2 * 1024 * 1024};
+    // Node 0 exists on every host, NUMA or not
+    for (int i = 0; i < 3; i++) {
+        void* ptr = allocator_malloc_onnode(sizes[i], 0);
+        TEST_ASSERT_NOT_NULL(ptr);
+        memset(ptr, 0x77, sizes[i]);
+        TEST_ASSERT_TRUE(allocator_usable_size(ptr) >= sizes[i]);
+        allocator_free(ptr);
+    }
+    TEST_ASSERT_NULL(allocator_malloc_onnode(64, -1));
+    TEST_ASSERT_NULL(allocator_malloc_onnode(64, 1 << 20));
+    TEST_ASSERT_NULL(allocator_malloc_onnode(0, 0));
+}
+
+void test_allocator_config_set_and_get(void) {
+    size_t threshold;
+    size_t arenas;
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_get("mmap_threshold", &threshold));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_get("arenas", &arenas));
+    TEST_ASSERT_TRUE(arenas >= 1);
+
+    // A lower threshold sends a medium request to its own mapping
+    allocator_stats_t before;
+    allocator_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("mmap_threshold", 256 * 1024));
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+    void* ptr = allocator_malloc(300 * 1024);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    TEST_ASSERT_EQUAL_UINT64(before.huge_allocs + 1, after.huge_allocs);
+    allocator_free(ptr);
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("mmap_threshold", threshold));
+
+    size_t value;
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("decay_ms", 250));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_get("decay_ms", &value));
+    TEST_ASSERT_EQUAL_UINT64(250, value);
+
+    // Out-of-range values, unknown names and late arena changes are refused
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_set("tcache_max", 0));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_set("mmap_threshold", 512));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_set("mmap_threshold", ALLOCATOR_MMAP_THRESHOLD + 1));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("mmap_threshold", ALLOCATOR_MMAP_THRESHOLD));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("mmap_threshold", 1024));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("mmap_threshold", threshold));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_set("huge_pages", 3));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_set("arenas", 2));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_set("no_such_setting", 1));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_get("no_such_setting", &value));
+}
+
+void test_allocator_arena_reset_and_destroy(void) {
+    allocator_arena_t* arena = allocator_arena_create();
+    TEST_ASSERT_NOT_NULL(arena);
+    TEST_ASSERT_NULL(allocator_arena_malloc(NULL, 16));
+
+    // Objects are aligned, distinct and span several blocks
+    char* first = allocator_arena_malloc(arena, 24);
+    TEST_ASSERT_NOT_NULL(first);
+    char* prev = first;
+    for (int i = 0; i < 10000; i++) {
+        char* ptr = allocator_arena_malloc(arena, 1 + i % 100);
+        TEST_ASSERT_NOT_NULL(ptr);
+        TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 16);
+        TEST_ASSERT_TRUE(ptr != prev);
+        memset(ptr, 0x5A, 1 + i % 100);
+        prev = ptr;
+    }
+    char* big = allocator_arena_malloc(arena, 200 * 1024);
+    TEST_ASSERT_NOT_NULL(big);
+    memset(big, 0xA5, 200 * 1024);
+
+    // After a reset the region starts over in its first block
+    allocator_arena_reset(arena);
+    TEST_ASSERT_EQUAL_PTR(first, allocator_arena_malloc(arena, 24));
+
+    allocator_arena_destroy(arena);
+    allocator_arena_destroy(NULL);
+    allocator_arena_reset(NULL);
+}
+
+void test_allocator_pool_alloc_and_free(void) {
+    TEST_ASSERT_NULL(allocator_pool_create(0, 8));
+    TEST_ASSERT_NULL(allocator_pool_create(24, 24));
+    TEST_ASSERT_NULL(allocator_pool_alloc(NULL));
+
+    // Objects are packed at the requested alignment, not the malloc() one
+    allocator_pool_t* pool = allocator_pool_create(24, 8);
+    TEST_ASSERT_NOT_NULL(pool);
+    static void* objects[5000];
+    for (int i = 0; i < 5000; i++) {
+        objects[i] = allocator_pool_alloc(pool);
+        TEST_ASSERT_NOT_NULL(objects[i]);
+        TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)objects[i] % 8);
+        TEST_ASSERT_EQUAL_UINT64(24, allocator_usable_size(objects[i]));
+        memset(objects[i], i & 0xFF, 24);
+    }
+    for (int i = 0; i < 5000; i++) {
+        TEST_ASSERT_EQUAL_UINT8(i & 0xFF, ((unsigned char*)objects[i])[23]);
+    }
+    // Either free function works, and freed objects are reused
+    for (int i = 0; i < 5000; i++) {
+        if (i % 2) {
+            allocator_free(objects[i]);
+        } else {
+            allocator_pool_free(pool, objects[i]);
+        }
+    }
+    void* reused = allocator_pool_alloc(pool);
+    TEST_ASSERT_EQUAL_PTR(objects[4999], reused);
+    TEST_ASSERT_EQUAL_PTR(reused, allocator_realloc(reused, 16));
+    allocator_pool_free(pool, reused);
+    allocator_pool_destroy(pool);
+
+    pool = allocator_pool_create(100, 64);
+    TEST_ASSERT_NOT_NULL(pool);
+    void* ptr = allocator_pool_alloc(pool);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 64);
+    TEST_ASSERT_EQUAL_UINT64(128, allocator_usable_size(ptr));
+    allocator_pool_destroy(pool);
+    allocator_pool_destroy(NULL);
+}
+
+void test_allocator_prof_sampling(void) {
+    TEST_ASSERT_EQUAL_INT(-1, allocator_prof_dump(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_prof_dump("/nonexistent/dir/profile.heap"));
+
+    // A one-byte mean samples every allocation, from the bins, the heap and huge mappings alike
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("prof_sample", 1));
+    void* small = allocator_malloc(64);
+    unsigned char* zeroed = allocator_calloc(4, 50);
+    void* large = allocator_malloc(4096);
+    void* huge = allocator_malloc(8 * 1024 * 1024);
+    TEST_ASSERT_NOT_NULL(small);
+    TEST_ASSERT_NOT_NULL(zeroed);
+    TEST_ASSERT_NOT_NULL(large);
+    TEST_ASSERT_NOT_NULL(huge);
+    for (int i = 0; i < 200; i++) {
+        TEST_ASSERT_EQUAL_UINT8(0, zeroed[i]);
+    }
+    allocator_free(large);
+    huge = allocator_realloc(huge, 16 * 1024 * 1024);
+    TEST_ASSERT_NOT_NULL(huge);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_allocator.%d.heap", (int)getpid());
+    TEST_ASSERT_EQUAL_INT(0, allocator_prof_dump(path));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("prof_sample", 0));
+    FILE* file = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(file);
+    static char contents[1 << 16];
+    size_t length = fread(contents, 1, sizeof(contents) - 1, file);
+    contents[length] = '\0';
+    fclose(file);
+    unlink(path);
+
+    // Live: small, zeroed and the resized huge block; allocated: all four at their first size
+    char header[128];
+    snprintf(header, sizeof(header), "heap profile: 3: %d [4: %d] @ heap_v2/1\n",
+             64 + 208 + 16 * 1024 * 1024, 64 + 208 + 4096 + 8 * 1024 * 1024);
+    TEST_ASSERT_EQUAL_INT(0, strncmp(contents, header, strlen(header)));
+    TEST_ASSERT_NOT_NULL(strstr(contents, "\nMAPPED_LIBRARIES:\n"));
+
+    allocator_free(small);
+    allocator_free(zeroed);
+    allocator_free(huge);
+
+    // Sampled blocks are only 16-byte aligned, so aligned requests stay unsampled
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("prof_sample", 1));
+    void* aligned = allocator_aligned_alloc(64, 48);
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("prof_sample", 0));
+    TEST_ASSERT_NOT_NULL(aligned);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)aligned % 64);
+    allocator_free(aligned);
+}
+
+void test_allocator_latency_histograms(void) {
+    allocator_latency_t latency;
+    memset(&latency, 0, sizeof(latency));
+    TEST_ASSERT_EQUAL_UINT64(0, allocator_latency_percentile(&latency, 50));
+    TEST_ASSERT_EQUAL_UINT64(0, allocator_latency_percentile(NULL, 50));
+
+    // Bucket 200 starts the power of two at 2^27 ns and is an eighth of it wide
+    latency.buckets[5] = 99;
+    latency.buckets[200] = 1;
+    TEST_ASSERT_EQUAL_UINT64(5, allocator_latency_percentile(&latency, 50));
+    TEST_ASSERT_EQUAL_UINT64(5, allocator_latency_percentile(&latency, 99));
+    TEST_ASSERT_EQUAL_UINT64((9ULL << 24) - 1, allocator_latency_percentile(&latency, 99.9));
+    TEST_ASSERT_EQUAL_UINT64((9ULL << 24) - 1, allocator_latency_percentile(&latency, 100));
+
+    allocator_stats_t before;
+    allocator_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+    void* ptr = allocator_malloc(4096);
+    TEST_ASSERT_NOT_NULL(ptr);
+    allocator_free(ptr);
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    if (ALLOCATOR_TRACE) {
+        // One lock for the allocation and one for the free
+        TEST_ASSERT_EQUAL_UINT64(before.lock_wait.count + 2, after.lock_wait.count);
+        TEST_ASSERT_EQUAL_UINT64(before.lock_hold.count + 2, after.lock_hold.count);
+    } else {
+        TEST_ASSERT_EQUAL_UINT64(0, after.lock_wait.count);
+        TEST_ASSERT_EQUAL_UINT64(0, after.lock_hold.count);
+        TEST_ASSERT_EQUAL_UINT64(0, after.os_map.count);
+    }
+}
+
+typedef struct walk_check {
+    void* used;      // Heap block expected in use
+    void* freed;     // Heap block expected free
+    void* small;     // Object expected in a slab
+    void* huge;      // Allocation expected in a huge mapping
+    int found;       // One bit per expectation met
+    int blocks;      // Blocks seen
+} walk_check_t;
+
+static int walk_check_block(const allocator_heap_block_t* block, void* ctx) {
+    walk_check_t* check = ctx;
+    char* start = block->addr;
+    check->blocks++;
+    if (block->kind == ALLOCATOR_WALK_HEAP && block->addr == check->used && !block->free &&
+        block->size >= 4096) {
+        check->found |= 1;
+    }
+    if (block->kind == ALLOCATOR_WALK_HEAP && block->addr == check->freed && block->free) {
+        check->found |= 2;
+    }
+    if (block->kind == ALLOCATOR_WALK_SLAB && (char*)check->small >= start &&
+        (char*)check->small < start + block->size && block->obj_size == 32 && block->objects_used > 0) {
+        check->found |= 4;
+    }
+    if (block->kind == ALLOCATOR_WALK_HUGE && block->addr == check->huge &&
+        block->mapping_size > block->size) {
+        check->found |= 8;
+    }
+    return 0;
+}
+
+static int walk_stop(const allocator_heap_block_t* block, void* ctx) {
+    (void)block;
+    (*(int*)ctx)++;
+    return 7;
+}
+
+void test_allocator_heap_walk_and_summary(void) {
+    TEST_ASSERT_EQUAL_INT(-1, allocator_heap_walk(NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_heap_summary(NULL));
+
+    // The middle block stays free between two blocks in use
+    void* first = allocator_malloc(4096);
+    void* middle = allocator_malloc(4096);
+    void* last = allocator_malloc(4096);
+    walk_check_t check = {.used = first, .freed = middle, .found = 0, .blocks = 0};
+    check.small = allocator_malloc(32);
+    check.huge = allocator_malloc(8 * 1024 * 1024);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(middle);
+    TEST_ASSERT_NOT_NULL(last);
+    TEST_ASSERT_NOT_NULL(check.small);
+    TEST_ASSERT_NOT_NULL(check.huge);
+    allocator_free(middle);
+
+    TEST_ASSERT_EQUAL_INT(0, allocator_heap_walk(walk_check_block, &check));
+    TEST_ASSERT_EQUAL_INT(15, check.found);
+    int calls = 0;
+    TEST_ASSERT_EQUAL_INT(7, allocator_heap_walk(walk_stop, &calls));
+    TEST_ASSERT_EQUAL_INT(1, calls);
+
+    allocator_heap_summary_t summary;
+    TEST_ASSERT_EQUAL_INT(0, allocator_heap_summary(&summary));
+    TEST_ASSERT_TRUE(summary.mappings >= 3);
+    TEST_ASSERT_TRUE(summary.used_bytes >= 2 * 4096 + 32 + 8 * 1024 * 1024);
+    TEST_ASSERT_TRUE(summary.mapped_bytes > summary.used_bytes + summary.free_bytes);
+    TEST_ASSERT_TRUE(summary.free_blocks >= 2);
+    TEST_ASSERT_TRUE(summary.largest_free >= 4096);
+    TEST_ASSERT_TRUE(summary.free_histogram[12] >= 1);
+    TEST_ASSERT_TRUE(summary.fragmentation > 0.0 && summary.fragmentation < 1.0);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_allocator.%d.report", (int)getpid());
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(0, allocator_heap_report(fd));
+    close(fd);
+    FILE* file = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(file);
+    static char contents[1 << 16];
+    size_t length = fread(contents, 1, sizeof(contents) - 1, file);
+    contents[length] = '\0';
+    fclose(file);
+    unlink(path);
+    TEST_ASSERT_EQUAL_INT(0, strncmp(contents, "heap report: ", 13));
+    TEST_ASSERT_NOT_NULL(strstr(contents, " heap arena "));
+    TEST_ASSERT_NOT_NULL(strstr(contents, " slab arena "));
+    TEST_ASSERT_NOT_NULL(strstr(contents, " huge: "));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_heap_report(-1));
+
+    allocator_free(first);
+    allocator_free(last);
+    allocator_free(check.small);
+    allocator_free(check.huge);
+}
+
+void test_allocator_malloc_class(void) {
+    TEST_ASSERT_NULL(allocator_malloc_class(ALLOCATOR_STATS_CLASSES));
+    void* ptr = allocator_malloc_class(2);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_UINT64(3 * ALLOCATOR_CLASS_SPACING, allocator_usable_size(ptr));
+    allocator_free_class(ptr, 2);
+    // The object went back to the bin that allocator_malloc() uses for its class
+    TEST_ASSERT_EQUAL_PTR(ptr, allocator_malloc(40));
+    allocator_free_class(ptr, 2);
+    allocator_free_class(NULL, 2);
+}
+
+void test_allocator_record_events(void) {
+    TEST_ASSERT_EQUAL_INT(-1, allocator_record_stop());
+    TEST_ASSERT_EQUAL_INT(-1, allocator_record_start(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_record_start("/nonexistent/dir/calls.trace"));
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_allocator.%d.trace", (int)getpid());
+    TEST_ASSERT_EQUAL_INT(0, allocator_record_start(path));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_record_start(path));
+
+    // The allocator does not record its own calls; the shim reports each one
+    void* first = allocator_malloc(100);
+    TEST_ASSERT_NOT_NULL(first);
+    allocator_record_event(ALLOCATOR_RECORD_MALLOC, first, NULL, 100, 0, 0);
+    uint64_t begin_ns = allocator_record_clock();
+    TEST_ASSERT_TRUE(begin_ns != 0);
+    void* second = allocator_realloc(first, 5000);
+    TEST_ASSERT_NOT_NULL(second);
+    allocator_record_event(ALLOCATOR_RECORD_REALLOC, second, first, 5000, 0, begin_ns);
+    allocator_record_event(ALLOCATOR_RECORD_FREE, second, NULL, 0, 0, 0);
+    allocator_free(second);
+    TEST_ASSERT_EQUAL_INT(0, allocator_record_stop());
+    TEST_ASSERT_EQUAL_INT(-1, allocator_record_stop());
+    // Calls after the stop are dropped
+    TEST_ASSERT_EQUAL_UINT64(0, allocator_record_clock());
+    allocator_record_event(ALLOCATOR_RECORD_MALLOC, first, NULL, 100, 0, 0);
+
+    FILE* file = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    allocator_record_header_t header;
+    allocator_record_t records[4];
+    TEST_ASSERT_EQUAL_UINT64(1, fread(&header, sizeof(header), 1, file));
+    size_t count = fread(records, sizeof(records[0]), 4, file);
+    fclose(file);
+    unlink(path);
+
+    TEST_ASSERT_EQUAL_INT(0, memcmp(header.magic, ALLOCATOR_RECORD_MAGIC, sizeof(header.magic)));
+    TEST_ASSERT_EQUAL_UINT32(ALLOCATOR_RECORD_VERSION, header.version);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(allocator_record_t), header.record_size);
+    TEST_ASSERT_EQUAL_UINT64(3, count);
+    TEST_ASSERT_EQUAL_UINT32(ALLOCATOR_RECORD_MALLOC, records[0].op);
+    TEST_ASSERT_EQUAL_UINT64((uintptr_t)first, records[0].ptr);
+    TEST_ASSERT_EQUAL_UINT64(100, records[0].size);
+    TEST_ASSERT_EQUAL_UINT32(ALLOCATOR_RECORD_REALLOC, records[1].op);
+    TEST_ASSERT_EQUAL_UINT64((uintptr_t)second, records[1].ptr);
+    TEST_ASSERT_EQUAL_UINT64((uintptr_t)first, records[1].old_ptr);
+    TEST_ASSERT_EQUAL_UINT64(5000, records[1].size);
+    TEST_ASSERT_EQUAL_UINT32(ALLOCATOR_RECORD_FREE, records[2].op);
+    TEST_ASSERT_EQUAL_UINT64((uintptr_t)second, records[2].ptr);
+    TEST_ASSERT_EQUAL_UINT32(records[0].thread, records[2].thread);
+    TEST_ASSERT_TRUE(records[0].time_ns <= records[1].time_ns);
+    TEST_ASSERT_TRUE(records[1].time_ns <= records[2].time_ns);
+    // The realloc released first before it returned
+    TEST_ASSERT_EQUAL_UINT64(records[0].time_ns, records[0].release_ns);
+    TEST_ASSERT_TRUE(records[0].time_ns <= records[1].release_ns);
+    TEST_ASSERT_TRUE(records[1].release_ns <= records[1].time_ns);
+}
+
 /* -------------------------------------------------------------------------
  * Main Runner
  * ------------------------------------------------------------------------- */
@@ -171,6 +931,28 @@ int main(void) {
     RUN_TEST(test_allocator_free_null);
     RUN_TEST(test_allocator_calloc);
     RUN_TEST(test_allocator_realloc_zero_size);
+    RUN_TEST(test_allocator_reuses_freed_large_block);
+    RUN_TEST(test_allocator_small_blocks_share_pages);
+    RUN_TEST(test_allocator_realloc_huge);
+    RUN_TEST(test_allocator_realloc_grows_in_place);
+    RUN_TEST(test_allocator_small_objects_have_no_header);
+    RUN_TEST(test_allocator_coalesces_adjacent_free_blocks);
+    RUN_TEST(test_allocator_deferred_coalescing);
+    RUN_TEST(test_allocator_trim_releases_free_memory);
+    RUN_TEST(test_allocator_stats_track_allocations);
+    RUN_TEST(test_allocator_aligned_alloc);
+    RUN_TEST(test_allocator_free_sized_and_usable_size);
+    RUN_TEST(test_allocator_batch_alloc_and_free);
+    RUN_TEST(test_allocator_calloc_clears_reused_memory);
+    RUN_TEST(test_allocator_malloc_onnode);
+    RUN_TEST(test_allocator_config_set_and_get);
+    RUN_TEST(test_allocator_arena_reset_and_destroy);
+    RUN_TEST(test_allocator_pool_alloc_and_free);
+    RUN_TEST(test_allocator_prof_sampling);
+    RUN_TEST(test_allocator_latency_histograms);
+    RUN_TEST(test_allocator_heap_walk_and_summary);
+    RUN_TEST(test_allocator_malloc_class);
+    RUN_TEST(test_allocator_record_events);
 
     return UNITY_END();
 }
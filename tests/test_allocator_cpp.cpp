@@ -0,0 +1,157 @@
+/**
+ * @file test_allocator_cpp.cpp
+ * @brief Unit tests for the C++ wrappers in allocator.hpp.
+ *
+ * This file also replaces the global operator new and delete, so every
+ * allocation made by the standard library here goes through the allocator.
+ *
+ * Author: Ameed Othman
+ * Date: 14/10/2026
+ */
+
+#include "unity.h"
+#include "allocator.hpp"
+#include <cstdint>
+#include <list>
+#include <map>
+#include <vector>
+
+MTALLOC_REPLACE_GLOBAL_NEW
+
+/* -------------------------------------------------------------------------
+ * Test Fixture Setup and Teardown
+ * ------------------------------------------------------------------------- */
+
+void setUp(void) {
+    TEST_ASSERT_EQUAL_INT(0, allocator_init());
+}
+
+// No allocator_destroy(): the C++ runtime keeps objects from the replaced new alive
+void tearDown(void) {
+}
+
+static_assert(mtalloc::size_class(1) == 0, "1 byte is in the first class");
+static_assert(mtalloc::size_class(16) == 0, "16 bytes are in the first class");
+static_assert(mtalloc::size_class(17) == 1, "17 bytes are in the second class");
+static_assert(mtalloc::size_class(1024) == 63, "1024 bytes are in the last class");
+static_assert(mtalloc::size_class(1025) == -1, "1025 bytes are above the classes");
+
+struct Node : mtalloc::mt_allocated<Node> {
+    Node* next;
+    long payload[5];
+};
+
+struct alignas(64) Aligned {
+    char bytes[72];
+};
+
+/* -------------------------------------------------------------------------
+ * Test Cases
+ * ------------------------------------------------------------------------- */
+
+void test_mt_allocator_map_uses_node_class(void) {
+    typedef std::pair<const int, int> value_type;
+    typedef std::map<int, int, std::less<int>, mtalloc::mt_allocator<value_type> > map_type;
+    allocator_stats_t before;
+    allocator_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+    {
+        map_type map;
+        for (int i = 0; i < 10000; i++) {
+            map[i] = i * 2;
+        }
+        TEST_ASSERT_EQUAL_UINT64(10000, map.size());
+        TEST_ASSERT_EQUAL_INT(9998, map[4999]);
+        for (int i = 0; i < 10000; i += 2) {
+            map.erase(i);
+        }
+        TEST_ASSERT_EQUAL_UINT64(5000, map.size());
+    }
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    // All 10000 nodes came from one small class and were given back to it
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    for (int i = 0; i < ALLOCATOR_STATS_CLASSES; i++) {
+        if (after.small_allocs[i] - before.small_allocs[i] >= 10000) {
+            allocs = after.small_allocs[i] - before.small_allocs[i];
+            frees = after.small_frees[i] - before.small_frees[i];
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT64(10000, allocs);
+    TEST_ASSERT_EQUAL_UINT64(10000, frees);
+    TEST_ASSERT_EQUAL_UINT64(before.live_bytes, after.live_bytes);
+}
+
+void test_mt_allocator_arrays_and_alignment(void) {
+    std::vector<int, mtalloc::mt_allocator<int> > numbers;
+    for (int i = 0; i < 100000; i++) {
+        numbers.push_back(i);
+    }
+    TEST_ASSERT_EQUAL_INT(99999, numbers.back());
+    numbers.clear();
+    numbers.shrink_to_fit();
+
+    mtalloc::mt_allocator<Aligned> aligned;
+    Aligned* one = aligned.allocate(1);
+    Aligned* many = aligned.allocate(3);
+    TEST_ASSERT_EQUAL_UINT64(0, reinterpret_cast<uintptr_t>(one) % 64);
+    TEST_ASSERT_EQUAL_UINT64(0, reinterpret_cast<uintptr_t>(many) % 64);
+    aligned.deallocate(one, 1);
+    aligned.deallocate(many, 3);
+
+    // Rebinding keeps the allocator equal, as node containers need
+    mtalloc::mt_allocator<std::list<int>::value_type> base;
+    mtalloc::mt_allocator<double> other(base);
+    TEST_ASSERT_TRUE(base == other);
+    std::list<int, mtalloc::mt_allocator<int> > list(100, 7);
+    TEST_ASSERT_EQUAL_UINT64(100, list.size());
+}
+
+void test_mt_allocated_operator_new(void) {
+    Node* node = new Node();
+    TEST_ASSERT_NOT_NULL(node);
+    TEST_ASSERT_EQUAL_UINT64(48, allocator_usable_size(node));
+    node->next = new (std::nothrow) Node();
+    TEST_ASSERT_NOT_NULL(node->next);
+    delete node->next;
+    delete node;
+
+    Node* nodes = new Node[10];
+    TEST_ASSERT_NOT_NULL(nodes);
+    delete[] nodes;
+}
+
+void test_global_new_is_replaced(void) {
+    allocator_stats_t before;
+    allocator_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+    int* value = new int(42);
+    long* values = new long[1000];
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    TEST_ASSERT_EQUAL_UINT64(before.small_allocs[0] + 1, after.small_allocs[0]);
+    TEST_ASSERT_EQUAL_UINT64(before.large_allocs + 1, after.large_allocs);
+    TEST_ASSERT_EQUAL_INT(42, *value);
+    delete value;
+    delete[] values;
+
+#if defined(__cpp_aligned_new)
+    Aligned* aligned = new Aligned();
+    TEST_ASSERT_EQUAL_UINT64(0, reinterpret_cast<uintptr_t>(aligned) % 64);
+    delete aligned;
+#endif
+}
+
+/* -------------------------------------------------------------------------
+ * Main Runner
+ * ------------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_mt_allocator_map_uses_node_class);
+    RUN_TEST(test_mt_allocator_arrays_and_alignment);
+    RUN_TEST(test_mt_allocated_operator_new);
+    RUN_TEST(test_global_new_is_replaced);
+
+    return UNITY_END();
+}
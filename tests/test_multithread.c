@@ -6,6 +6,7 @@
  * when used from multiple threads concurrently. We will:
  *  - Spawn multiple threads performing random allocations, frees, and reallocations.
  *  - Check for data consistency and absence of crashes or corruption.
+ *  - Report malloc/free throughput as the thread count grows from 1 to NUM_THREADS.
  *
  * Author: Ameed Othman
  * Date: 03/12/2024
@@ -14,10 +15,13 @@
 #include "unity.h"
 #include "allocator.h"
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 /* -------------------------------------------------------------------------
  * Configuration Constants
@@ -38,6 +42,39 @@
 /** @brief Pattern to use after reallocation. */
 #define REALLOC_PATTERN 0x5A
 
+/** @brief Number of malloc/free pairs each thread performs in the scaling run. */
+#define SCALING_OPS_PER_THREAD 200000
+
+/** @brief Number of live blocks each thread keeps around in the scaling run. */
+#define SCALING_WINDOW 64
+
+/** @brief Maximum size of each allocation in the scaling run. */
+#define SCALING_MAX_SIZE 512
+
+/** @brief Number of blocks each producer thread hands to the main thread. */
+#define HANDOFF_BLOCKS 256
+
+/** @brief Size of each handed-off block, above the thread cache limit. */
+#define HANDOFF_SIZE 4096
+
+/** @brief Number of blocks passed from producer to consumer in the pipeline run. */
+#define PIPELINE_BLOCKS 100000
+
+/** @brief Number of slots in the pipeline's handoff ring. */
+#define PIPELINE_RING 256
+
+/** @brief Size of the freed heap block the background thread must purge. */
+#define BACKGROUND_PURGE_SIZE (512 * 1024)
+
+/** @brief Longest the background run waits for a purge, in milliseconds. */
+#define BACKGROUND_WAIT_MS 3000
+
+/** @brief Number of times the fork run forks while other threads allocate. */
+#define FORK_ROUNDS 50
+
+/** @brief Seconds a forked child may take before it counts as deadlocked. */
+#define FORK_CHILD_TIMEOUT 10
+
 /* -------------------------------------------------------------------------
  * Test Data Structures and Globals
  * ------------------------------------------------------------------------- */
@@ -106,6 +143,163 @@ static void* thread_worker(void* arg) {
     return NULL;
 }
 
+/**
+ * @brief Perform SCALING_OPS_PER_THREAD malloc/free pairs over a small window.
+ *
+ * Each slot of the window is freed and reallocated in turn, so the thread keeps
+ * SCALING_WINDOW blocks live while it churns through small size classes.
+ */
+static void* scaling_worker(void* arg) {
+    thread_arg_t* t_arg = (thread_arg_t*)arg;
+    unsigned seed = t_arg->seed;
+    void* window[SCALING_WINDOW] = {0};
+
+    for (int i = 0; i < SCALING_OPS_PER_THREAD; i++) {
+        int slot = i % SCALING_WINDOW;
+        allocator_free(window[slot]);
+        size_t size = (rand_r(&seed) % SCALING_MAX_SIZE) + 1;
+        window[slot] = allocator_malloc(size);
+        TEST_ASSERT_NOT_NULL_MESSAGE(window[slot], "Failed to allocate memory in scaling run.");
+        *(uint8_t*)window[slot] = INIT_PATTERN;
+    }
+    for (int i = 0; i < SCALING_WINDOW; i++) {
+        allocator_free(window[i]);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Allocate HANDOFF_BLOCKS medium blocks for another thread to free.
+ *
+ * The blocks are returned through the thread argument's slot array.
+ */
+static void* handoff_worker(void* arg) {
+    void** blocks = (void**)arg;
+    for (int i = 0; i < HANDOFF_BLOCKS; i++) {
+        blocks[i] = allocator_malloc(HANDOFF_SIZE);
+        TEST_ASSERT_NOT_NULL_MESSAGE(blocks[i], "Failed to allocate memory in handoff run.");
+        memset(blocks[i], INIT_PATTERN, HANDOFF_SIZE);
+    }
+    return NULL;
+}
+
+/** @brief Handoff ring between the pipeline producer and consumer. */
+static void* pipeline_ring[PIPELINE_RING];
+
+/**
+ * @brief Allocate PIPELINE_BLOCKS blocks and pass them to the consumer.
+ */
+static void* pipeline_producer(void* arg) {
+    (void)arg;
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        size_t size = (i % 2) ? HANDOFF_SIZE : (size_t)(i % MAX_ALLOC_SIZE) + 1;
+        uint8_t* ptr = (uint8_t*)allocator_malloc(size);
+        TEST_ASSERT_NOT_NULL_MESSAGE(ptr, "Failed to allocate memory in pipeline run.");
+        ptr[0] = INIT_PATTERN;
+        void** slot = &pipeline_ring[i % PIPELINE_RING];
+        while (__atomic_load_n(slot, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        __atomic_store_n(slot, ptr, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Free every block the producer passes along.
+ */
+static void* pipeline_consumer(void* arg) {
+    (void)arg;
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        void** slot = &pipeline_ring[i % PIPELINE_RING];
+        uint8_t* ptr;
+        while (!(ptr = __atomic_exchange_n(slot, NULL, __ATOMIC_ACQUIRE))) {
+            sched_yield();
+        }
+        TEST_ASSERT_EQUAL_UINT8_MESSAGE(INIT_PATTERN, ptr[0], "Pipeline block corrupted.");
+        allocator_free(ptr);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocate PIPELINE_BLOCKS pool objects and pass them to the consumer.
+ */
+static void* pool_producer(void* arg) {
+    allocator_pool_t* pool = (allocator_pool_t*)arg;
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        uint8_t* ptr = (uint8_t*)allocator_pool_alloc(pool);
+        TEST_ASSERT_NOT_NULL_MESSAGE(ptr, "Failed to allocate from pool in pipeline run.");
+        memset(ptr, INIT_PATTERN, 48);
+        void** slot = &pipeline_ring[i % PIPELINE_RING];
+        while (__atomic_load_n(slot, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        __atomic_store_n(slot, ptr, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Return every pool object the producer passes along to the pool.
+ */
+static void* pool_consumer(void* arg) {
+    allocator_pool_t* pool = (allocator_pool_t*)arg;
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        void** slot = &pipeline_ring[i % PIPELINE_RING];
+        uint8_t* ptr;
+        while (!(ptr = __atomic_exchange_n(slot, NULL, __ATOMIC_ACQUIRE))) {
+            sched_yield();
+        }
+        TEST_ASSERT_EQUAL_UINT8_MESSAGE(INIT_PATTERN, ptr[47], "Pool object corrupted.");
+        allocator_pool_free(pool, ptr);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Fill the thread cache with small blocks and exit with them still cached.
+ */
+static void* cache_worker(void* arg) {
+    (void)arg;
+    void* blocks[HANDOFF_BLOCKS];
+    for (int i = 0; i < HANDOFF_BLOCKS; i++) {
+        blocks[i] = allocator_malloc(64);
+        TEST_ASSERT_NOT_NULL_MESSAGE(blocks[i], "Failed to allocate memory in background run.");
+    }
+    for (int i = 0; i < HANDOFF_BLOCKS; i++) {
+        allocator_free(blocks[i]);
+    }
+    return NULL;
+}
+
+/** @brief Set to stop the fork run's allocating threads. */
+static int fork_stop = 0;
+
+/**
+ * @brief Allocate and free blocks of every kind until fork_stop is set.
+ */
+static void* fork_worker(void* arg) {
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    while (!__atomic_load_n(&fork_stop, __ATOMIC_RELAXED)) {
+        size_t size = (rand_r(&seed) % 4) == 0 ? HANDOFF_SIZE : (size_t)(rand_r(&seed) % MAX_ALLOC_SIZE) + 1;
+        void* ptr = allocator_malloc(size);
+        TEST_ASSERT_NOT_NULL_MESSAGE(ptr, "Failed to allocate memory in fork run.");
+        allocator_free(ptr);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get the current time in seconds from CLOCK_MONOTONIC.
+ */
+static double get_time_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
 /* -------------------------------------------------------------------------
  * Test Case
  * ------------------------------------------------------------------------- */
@@ -144,6 +338,268 @@ void test_multithreaded_allocations(void) {
     TEST_PASS_MESSAGE("Multithreaded allocations, frees, and reallocations passed without errors.");
 }
 
+/**
+ * @brief Reports malloc/free throughput from 1 to NUM_THREADS threads.
+ *
+ * Throughput depends on the machine, so this only prints ops/sec for each
+ * thread count; it fails only if an allocation fails or a thread cannot run.
+ */
+void test_multithreaded_scaling(void) {
+    pthread_t threads[NUM_THREADS];
+    thread_arg_t args[NUM_THREADS];
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, allocator_init(), "Failed to initialize allocator for scaling run.");
+
+    printf("Scaling Results (malloc/free pairs):\n");
+    for (int nthreads = 1; nthreads <= NUM_THREADS; nthreads *= 2) {
+        double start = get_time_sec();
+        for (int i = 0; i < nthreads; i++) {
+            args[i].thread_id = i;
+            args[i].seed = (unsigned)(i + 1);
+            int rc = pthread_create(&threads[i], NULL, scaling_worker, &args[i]);
+            TEST_ASSERT_EQUAL_INT_MESSAGE(0, rc, "Failed to create scaling thread.");
+        }
+        for (int i = 0; i < nthreads; i++) {
+            int rc = pthread_join(threads[i], NULL);
+            TEST_ASSERT_EQUAL_INT_MESSAGE(0, rc, "Failed to join scaling thread.");
+        }
+        double elapsed = get_time_sec() - start;
+        double ops = (double)nthreads * SCALING_OPS_PER_THREAD;
+        printf("  %2d thread(s): %.0f ops/sec\n", nthreads, ops / elapsed);
+    }
+
+    allocator_destroy();
+}
+
+/**
+ * @brief Tests freeing blocks on a different thread than the one that allocated them.
+ *
+ * Producer threads allocate medium-sized blocks and exit; the main thread then
+ * checks and frees them all, so every block goes back to an arena the main
+ * thread is not bound to. Reallocating afterwards must reuse that memory.
+ */
+void test_multithreaded_cross_thread_free(void) {
+    pthread_t threads[NUM_THREADS];
+    static void* blocks[NUM_THREADS][HANDOFF_BLOCKS];
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, allocator_init(), "Failed to initialize allocator for handoff run.");
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        int rc = pthread_create(&threads[i], NULL, handoff_worker, blocks[i]);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, rc, "Failed to create handoff thread.");
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        int rc = pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, rc, "Failed to join handoff thread.");
+    }
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        for (int j = 0; j < HANDOFF_BLOCKS; j++) {
+            uint8_t* ptr = (uint8_t*)blocks[i][j];
+            TEST_ASSERT_EQUAL_UINT8_MESSAGE(INIT_PATTERN, ptr[0], "Handed-off block corrupted.");
+            TEST_ASSERT_EQUAL_UINT8_MESSAGE(INIT_PATTERN, ptr[HANDOFF_SIZE - 1], "Handed-off block corrupted.");
+            allocator_free(ptr);
+        }
+    }
+
+    void* ptr = allocator_malloc(HANDOFF_SIZE);
+    TEST_ASSERT_NOT_NULL_MESSAGE(ptr, "Failed to allocate after cross-thread frees.");
+    allocator_free(ptr);
+
+    allocator_destroy();
+}
+
+/**
+ * @brief Tests a producer/consumer pipeline where every block is freed remotely.
+ *
+ * One thread allocates and another frees, concurrently, so the owner keeps
+ * allocating while remote frees flow back to it.
+ */
+void test_multithreaded_pipeline(void) {
+    pthread_t producer;
+    pthread_t consumer;
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, allocator_init(), "Failed to initialize allocator for pipeline run.");
+
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&producer, NULL, pipeline_producer, NULL));
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&consumer, NULL, pipeline_consumer, NULL));
+    TEST_ASSERT_EQUAL_INT(0, pthread_join(producer, NULL));
+    TEST_ASSERT_EQUAL_INT(0, pthread_join(consumer, NULL));
+
+    allocator_destroy();
+}
+
+/**
+ * @brief Tests a pool whose objects are all freed by another thread.
+ *
+ * The consumer's frees must find their way back to the producer through the
+ * pool's shared list, or the pool would keep mapping new chunks.
+ */
+void test_multithreaded_pool_pipeline(void) {
+    pthread_t producer;
+    pthread_t consumer;
+
+    allocator_pool_t* pool = allocator_pool_create(48, 16);
+    TEST_ASSERT_NOT_NULL_MESSAGE(pool, "Failed to create pool for pipeline run.");
+    allocator_stats_t before;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&producer, NULL, pool_producer, pool));
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&consumer, NULL, pool_consumer, pool));
+    TEST_ASSERT_EQUAL_INT(0, pthread_join(producer, NULL));
+    TEST_ASSERT_EQUAL_INT(0, pthread_join(consumer, NULL));
+
+    // Without recycling, PIPELINE_BLOCKS objects would need a second chunk
+    allocator_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    TEST_ASSERT_EQUAL_UINT64(before.mmap_calls + 1, after.mmap_calls);
+    allocator_pool_destroy(pool);
+}
+
+/**
+ * @brief Tests that the background thread purges memory no thread touches.
+ *
+ * Application threads leave purging to the background thread while it runs,
+ * so the freed block is only released if a pass gets to it. A worker exiting
+ * with a full cache hands its blocks over on the way.
+ */
+void test_multithreaded_background_thread(void) {
+    size_t decay_ms = 0;
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_get("decay_ms", &decay_ms));
+    TEST_ASSERT_EQUAL_INT(-1, allocator_config_set("background_thread", 2));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("background_thread", 1));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("decay_ms", 10));
+    TEST_ASSERT_EQUAL_INT(0, allocator_init());
+
+    pthread_t worker;
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&worker, NULL, cache_worker, NULL));
+    TEST_ASSERT_EQUAL_INT(0, pthread_join(worker, NULL));
+
+    allocator_stats_t before;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+    void* block = allocator_malloc(BACKGROUND_PURGE_SIZE);
+    void* guard = allocator_malloc(HANDOFF_SIZE);
+    TEST_ASSERT_NOT_NULL(block);
+    TEST_ASSERT_NOT_NULL(guard);
+    memset(block, INIT_PATTERN, BACKGROUND_PURGE_SIZE);
+    allocator_free(block);
+
+    allocator_stats_t after = before;
+    for (int waited = 0; waited < BACKGROUND_WAIT_MS && after.purged_bytes == before.purged_bytes; waited += 10) {
+        struct timespec pause = {0, 10 * 1000000};
+        nanosleep(&pause, NULL);
+        TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    }
+    TEST_ASSERT_TRUE_MESSAGE(after.purged_bytes > before.purged_bytes, "Background thread did not purge.");
+
+    allocator_free(guard);
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("background_thread", 0));
+    TEST_ASSERT_EQUAL_INT(0, allocator_config_set("decay_ms", decay_ms));
+    allocator_destroy();
+}
+
+/**
+ * @brief Tests that a child forked while other threads allocate can allocate too.
+ *
+ * The fork handlers the allocator registers itself hold every lock across
+ * fork(), so the child never starts with a lock owned by a thread it lacks.
+ * A child that deadlocks anyway is killed by its alarm and fails the test.
+ */
+void test_multithreaded_fork(void) {
+    pthread_t threads[NUM_THREADS];
+    __atomic_store_n(&fork_stop, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        int rc = pthread_create(&threads[i], NULL, fork_worker, (void*)(uintptr_t)(i + 1));
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, rc, "Failed to create fork run thread.");
+    }
+
+    for (int round = 0; round < FORK_ROUNDS; round++) {
+        pid_t pid = fork();
+        TEST_ASSERT_TRUE_MESSAGE(pid >= 0, "fork() failed.");
+        if (pid == 0) {
+            alarm(FORK_CHILD_TIMEOUT);
+            void* small = allocator_malloc(64);
+            void* large = allocator_malloc(HANDOFF_SIZE);
+            void* huge = allocator_malloc(8 * 1024 * 1024);
+            int ok = small && large && huge;
+            allocator_free(small);
+            allocator_free(large);
+            allocator_free(huge);
+            _exit(ok ? 0 : 1);
+        }
+        int status = 0;
+        TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+        TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+                                 "Forked child could not allocate.");
+    }
+
+    __atomic_store_n(&fork_stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_join(threads[i], NULL));
+    }
+}
+
+void test_multithreaded_fork_after_destroy(void) {
+    // allocator_destroy() unmaps the chunk holding the pool header, so the
+    // fork handlers must no longer find the pool
+    allocator_pool_t* pool = allocator_pool_create(64, 16);
+    TEST_ASSERT_NOT_NULL(pool);
+    TEST_ASSERT_NOT_NULL(allocator_pool_alloc(pool));
+    allocator_destroy();
+    TEST_ASSERT_EQUAL_INT(0, allocator_init());
+
+    pid_t pid = fork();
+    TEST_ASSERT_TRUE_MESSAGE(pid >= 0, "fork() failed.");
+    if (pid == 0) {
+        alarm(FORK_CHILD_TIMEOUT);
+        void* ptr = allocator_malloc(64);
+        allocator_free(ptr);
+        _exit(ptr ? 0 : 1);
+    }
+    int status = 0;
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+                             "Fork after allocator_destroy() failed.");
+}
+
+static pthread_key_t late_key;
+
+/**
+ * @brief Destructor of a key created after the allocator's, so it runs once the thread cache has retired.
+ */
+static void late_destructor(void* arg) {
+    (void)arg;
+    void* ptr = allocator_malloc(64);
+    allocator_free(ptr);
+}
+
+/**
+ * @brief Sets up a thread cache, then arms late_key so that late_destructor() runs when the thread exits.
+ */
+static void* late_worker(void* arg) {
+    void* ptr = allocator_malloc(64);
+    allocator_free(ptr);
+    pthread_setspecific(late_key, arg);
+    return NULL;
+}
+
+void test_multithreaded_allocation_after_thread_exit(void) {
+    // The allocator's own key already exists, so this destructor comes after its one
+    TEST_ASSERT_EQUAL_INT(0, pthread_key_create(&late_key, late_destructor));
+    allocator_stats_t before;
+    allocator_stats_t after;
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&before));
+    pthread_t thread;
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&thread, NULL, late_worker, &late_key));
+    TEST_ASSERT_EQUAL_INT(0, pthread_join(thread, NULL));
+    TEST_ASSERT_EQUAL_INT(0, allocator_get_stats(&after));
+    pthread_key_delete(late_key);
+
+    // 64 bytes is class 3; the late calls are counted rather than lost with the retired cache
+    TEST_ASSERT_EQUAL_UINT64(before.small_allocs[3] + 2, after.small_allocs[3]);
+    TEST_ASSERT_EQUAL_UINT64(before.small_frees[3] + 2, after.small_frees[3]);
+}
+
 /* -------------------------------------------------------------------------
  * Test Runner
  * 
@@ -154,5 +610,13 @@ void test_multithreaded_allocations(void) {
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_multithreaded_allocations);
+    RUN_TEST(test_multithreaded_scaling);
+    RUN_TEST(test_multithreaded_cross_thread_free);
+    RUN_TEST(test_multithreaded_pipeline);
+    RUN_TEST(test_multithreaded_pool_pipeline);
+    RUN_TEST(test_multithreaded_background_thread);
+    RUN_TEST(test_multithreaded_fork);
+    RUN_TEST(test_multithreaded_fork_after_destroy);
+    RUN_TEST(test_multithreaded_allocation_after_thread_exit);
     return UNITY_END();
 }